@@ -0,0 +1,441 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "core.h"
+#include "display.h"
+
+#define FIRST_NIBBLE 0xF000
+#define SECOND_NIBBLE 0x0F00
+#define THIRD_NIBBLE 0x00F0
+#define FOURTH_NIBBLE 0x000F
+#define SECOND_BYTE 0x00FF
+#define ADDR_NIBBLES 0x0FFF
+
+/* Stores that can hit a watchpoint go through this, without the debugger
+   it's a plain store */
+#ifdef DEBUGGER
+#define STORE(c, addr, value)                                                  \
+  do {                                                                         \
+    uint16_t store_addr = (addr);                                              \
+    (c)->mem[store_addr] = (value);                                            \
+    if (bitmap_test((c)->watchpoints, store_addr)) {                           \
+      (c)->watch_hit = 1;                                                      \
+      (c)->watch_addr = store_addr;                                            \
+    }                                                                          \
+  } while (0)
+#else
+#define STORE(c, addr, value) ((c)->mem[(addr)] = (value))
+#endif
+
+/* NOTE: CHIP-8 IS BIG ENDIAN */
+
+/* TODO There are several instructions that are ambiguous, meaning
+   they differ between modern and original behaviour.
+   One way to maintain (some sort of) compatability is to give the user
+   the option to change how they want it to behave.
+   This could for example be set with a CLI switch.
+
+   Perhaps I could assign relevant functions to function pointers? */
+
+/* Push program counter to stack */
+void push_pc(uint16_t pc, Stack *st) {
+  st->stack[st->len] = pc;
+  st->len++;
+}
+
+/* Pop program counter from stack */
+uint16_t pop_pc(Stack *st) {
+  st->len--;
+  return st->stack[st->len];
+}
+
+/* Counted rather than printed, the front end decides what to say about it
+   and cores stay free of I/O */
+static void unknown(Chip8 *c, uint16_t instruction) {
+  c->unknown++;
+  c->last_unknown = instruction;
+}
+
+/* xorshift32, kept in the state instead of using rand() so a run only
+   depends on its seed */
+static uint8_t chip8_rand(Chip8 *c) {
+  uint32_t x = c->rng;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  c->rng = x;
+  return x >> 24;
+}
+
+uint64_t fnv1a64(const void *data, size_t len) {
+  const uint8_t *bytes = data;
+  uint64_t hash = 0xCBF29CE484222325;
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001B3;
+  }
+  return hash;
+}
+
+void chip8_init(Chip8 *c, uint32_t seed) {
+  memset(c, 0, sizeof *c);
+  init_font(&c->mem[FONT_ADDR]);
+  c->pc = START_ADDR;
+  /* xorshift gets stuck on 0 */
+  c->rng = seed ? seed : 0x2545F491;
+}
+
+void chip8_tick(Chip8 *c) {
+  if (c->sound_timer > 0) {
+    c->sound_timer -= 1;
+  }
+  if (c->delay_timer > 0) {
+    c->delay_timer -= 1;
+  }
+}
+
+void chip8_step(Chip8 *c) {
+  uint16_t instruction = 0;
+  uint8_t first_nibble = 0;
+  uint8_t second_nibble = 0;
+  uint8_t third_nibble = 0;
+  uint8_t fourth_nibble = 0;
+
+  uint8_t *x_reg = NULL;
+  uint8_t *y_reg = NULL;
+  uint8_t number = 0;
+  uint8_t imm_number = 0;
+  uint16_t imm_addr = 0;
+
+  uint8_t sprite[16];
+  uint8_t key_state = 0;
+
+  /* Read two bytes as one instruction, big endian */
+  instruction = (c->mem[c->pc & 0xFFF] << 8) | (c->mem[(c->pc + 1) & 0xFFF]);
+
+  /* Increase pc by two */
+  c->pc += 2;
+  if (c->pc >= 4096) {
+    /* Not entirely sure what should happen here, as the program
+     shouldn't overflow the program counter to begin with. The fetch above
+     wraps so at least we never read outside memory */
+    // exit(1);
+  }
+
+  /* Pick apart and carry out the instruction */
+
+  /* We decode by each nibble */
+  first_nibble = ((instruction & FIRST_NIBBLE) >> 12); // top of instruction
+  second_nibble = ((instruction & SECOND_NIBBLE) >> 8);
+  third_nibble = ((instruction & THIRD_NIBBLE) >> 4);
+  fourth_nibble = instruction & FOURTH_NIBBLE;
+
+  /* Depending on the instruction, any nibble or combination of nibbles
+               past the first will carry some meaning. We pick apart all
+     possible meanings here, so we can use them easily */
+  x_reg = &c->reg[second_nibble];            // x register value
+  y_reg = &c->reg[third_nibble];             // y register value
+  number = instruction & FOURTH_NIBBLE;   // a 4-bit number
+  imm_number = instruction & SECOND_BYTE; // 8-bit immediate number
+  imm_addr = instruction & ADDR_NIBBLES;  // 12-bit immediate address
+
+  switch (first_nibble) {
+  case 0x0:
+    switch (fourth_nibble) {
+    case 0x0:
+      /* Clear display */
+      clear_display(c->display);
+      break;
+
+    case 0xE:
+      /* Return from subroutine */
+      c->pc = pop_pc(&c->stack);
+      break;
+    default:
+      unknown(c, instruction);
+      break;
+    }
+    break;
+
+  case 0x1:
+    /* jump 1NNN (to imm_addr) */
+    c->pc = imm_addr;
+    break;
+
+  case 0x2:
+    /* push pc to stack and jump to subroutine */
+    push_pc(c->pc, &c->stack);
+    c->pc = imm_addr;
+    break;
+
+  case 0x3:
+    // puts("if x ==...");
+    if (*x_reg == imm_number) {
+      c->pc += 2;
+    }
+    break;
+
+  case 0x4:
+    // puts("if x !=...");
+    if (*x_reg != imm_number) {
+      c->pc += 2;
+    }
+    break;
+
+  case 0x5:
+    // puts("if x == y...");
+    if (*x_reg == *y_reg) {
+      c->pc += 2;
+    }
+    break;
+
+  case 0x6:
+    // puts("x = imm");
+    *x_reg = imm_number;
+    break;
+
+  case 0x7:
+    // puts("add x,#imm");
+    *x_reg += imm_number;
+    break;
+
+  case 0x8:
+    switch (fourth_nibble) {
+    case 0x0:
+      // set VX to value of VY
+      *x_reg = *y_reg;
+      break;
+    case 0x1:
+      // set VX to (VX | VY)
+      *x_reg = (*x_reg | *y_reg);
+      c->reg[0xF] = 0; // Original behaviour
+      break;
+    case 0x2:
+      // set VX to (VX & VY)
+      *x_reg = (*x_reg & *y_reg);
+      c->reg[0xF] = 0; // Original behaviour
+      break;
+    case 0x3:
+      // set VX to (VX ^ VY)
+      *x_reg = (*x_reg ^ *y_reg);
+      c->reg[0xF] = 0; // Original behaviour
+      break;
+    case 0x4:
+      /* add VY to VX, VY unaffected
+       should set VF if VX overflows */
+      if (*x_reg + *y_reg > 255) {
+        *x_reg += *y_reg;
+        c->reg[0xF] = 1;
+      } else {
+        *x_reg += *y_reg;
+        c->reg[0xF] = 0;
+      }
+      break;
+    case 0x5:
+      // VX = VX - VY
+      if (*x_reg >= *y_reg) {
+        *x_reg = *x_reg - *y_reg;
+        c->reg[0xF] = 1;
+      } else {
+        *x_reg = *x_reg - *y_reg;
+        c->reg[0xF] = 0;
+      }
+      break;
+    case 0x6:
+      // FIXME AMBIGUOUS, original for now
+      // VY into VX, then shift VX right
+      *x_reg = *y_reg;
+      if (*x_reg & 0x1) {
+        *x_reg >>= 1;
+        c->reg[0xF] = 1;
+      } else {
+        *x_reg >>= 1;
+        c->reg[0xF] = 0;
+      }
+      break;
+    case 0x7:
+      // VX = VY - VX
+      if (*y_reg >= *x_reg) {
+        *x_reg = *y_reg - *x_reg;
+        c->reg[0xF] = 1;
+      } else {
+        *x_reg = *y_reg - *x_reg;
+        c->reg[0xF] = 0;
+      }
+      break;
+    case 0xE:
+      // FIXME AMBIGUOUS, original for now
+      // VY into VX, then shift VX left
+      *x_reg = *y_reg;
+      if (*x_reg & 0x80) {
+        *x_reg <<= 1;
+        c->reg[0xF] = 1;
+      } else {
+        *x_reg <<= 1;
+        c->reg[0xF] = 0;
+      }
+      break;
+
+    default:
+      unknown(c, instruction);
+      break;
+    }
+    break;
+
+  case 0x9:
+    // puts("if x != y...");
+    if (*x_reg != *y_reg) {
+      c->pc += 2;
+    }
+    break;
+
+  case 0xA:
+    // puts("mov ind,#addr");
+    c->ind = imm_addr;
+    break;
+
+  case 0xB:
+    // FIXME AMBIGUOUS, original for now, apparently more compatible??
+    // Jump to imm_addr + V0 (jump with offset)
+    c->pc = imm_addr + c->reg[0x0];
+    break;
+
+  case 0xC:
+    // Generate random number and & it with NN, assign to VX
+    *x_reg = chip8_rand(c) & imm_number;
+    break;
+
+  case 0xD:
+    /* Drawing, see function for info */
+    /* The sprite may run past the end of memory, wrap it like FX33 does */
+    for (int i = 0; i < number; i++) {
+      sprite[i] = c->mem[(c->ind + i) & 0xFFF];
+    }
+    c->reg[0xF] = draw(c->display, *x_reg, *y_reg, number, sprite);
+    break;
+
+  case 0xE:
+
+    key_state = (c->keys >> (*x_reg & 0xF)) & 1;
+
+    switch (fourth_nibble) {
+      /* Skips following instruction (i.e. increases PC) depending on
+         whether a key is being held -- can't implement until I have input */
+
+    case 0xE:
+      // skip if key in VX is held
+      if (key_state) {
+        c->pc += 2;
+      }
+      break;
+
+    case 0x1:
+      // skip if key in VX is NOT held
+      if (!key_state) {
+        c->pc += 2;
+      }
+      break;
+
+    default:
+      unknown(c, instruction);
+      break;
+    }
+    break;
+
+  case 0xF:
+    /* This could also switch on imm_number, but that felt less readable
+     */
+    switch ((third_nibble << 4) | fourth_nibble) {
+    // switch (imm_number) {
+    case 0x07:
+      // Set VX to delay timer
+      *x_reg = c->delay_timer;
+      break;
+
+    case 0x15:
+      // Set delay timer to VX
+      c->delay_timer = *x_reg;
+      break;
+
+    case 0x18:
+      // Set sound timer to VX
+      c->sound_timer = *x_reg;
+      break;
+
+    case 0x1E:
+      /* add VX to index, sets non-standard "overflow" flag but should be
+         safe, see "Add to index" in the guide */
+      if ((c->ind + *x_reg) > 0xFFF) {
+        c->ind = (c->ind + *x_reg) & 0xFFF;
+        c->reg[0xF] = 1;
+      } else {
+        c->ind = (c->ind + *x_reg) & 0xFFF;
+        c->reg[0xF] = 0;
+      }
+      break;
+
+    case 0x0A:
+      /* wait (block) until key, put key in VX. timers should still move.
+         on the original cosmac vip, it was PRESS AND RELEASE. but just
+         press is likely fine. */
+
+      c->pc -= 2;
+      for (int i = 0; i < 16; i++) {
+        /* This might be faulty logic! This gets any key, even if it was
+         * already held (i.e., isn't a new key)*/
+        if ((c->keys >> i) & 1) {
+          *x_reg = i;
+          /* We got a key, so we inc the program counter again so
+             we break out of the instruction loop and continue to the
+             next */
+          c->pc += 2;
+          break;
+        }
+      }
+      break;
+
+    case 0x29:
+      /* set ind to point at hexadecimal char in VX. Font starts at 0x50,
+         and each character is a 5-byte sequence. I may not need to mask
+         for the last nibble here, but I doubt it's a performance hit
+         even if it's unnecessary... */
+      c->ind = 0x50 + (*x_reg & 0xF) * 5;
+      break;
+
+    case 0x33:
+      /* Take number from VX (0-255 because 8 bits) and get 3 decimal
+         numbers, e.g. 159 would be 1, 5, 9 (division and modulo for
+         this). Store result in mem[ind], mem[ind+1], mem[ind+2] */
+
+      STORE(c, c->ind, *x_reg / 100);
+      STORE(c, (c->ind + 1) & 0xFFF, (*x_reg % 100) / 10);
+      STORE(c, (c->ind + 2) & 0xFFF, (*x_reg) % 10);
+      break;
+
+    case 0x55:
+      /* Store registers V0 through VX (inclusive) to memory, starting at
+      ind */
+      for (int i = 0; i <= second_nibble; i++) {
+        STORE(c, c->ind, c->reg[i]);
+        c->ind = (c->ind + 1) & 0xFFF;
+      }
+      break;
+
+    case 0x65:
+      // Opposite of last, loads registers from memory
+      for (int i = 0; i <= second_nibble; i++) {
+        c->reg[i] = c->mem[c->ind];
+        c->ind = (c->ind + 1) & 0xFFF;
+      }
+      break;
+
+    default:
+      unknown(c, instruction);
+      break;
+    }
+    break;
+
+  default:
+    unknown(c, instruction);
+    break;
+  }
+}
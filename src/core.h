@@ -0,0 +1,87 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#define START_ADDR 0x200
+#define FONT_ADDR 0x50
+#define MEM_SIZE 4096
+#define WIDTH 64
+#define HEIGHT 32
+
+/* Call stack. len is a uint8_t and there are 256 slots, so even a ROM that
+   returns more often than it calls just wraps around instead of reading
+   outside the array */
+typedef struct {
+  uint16_t stack[256];
+  uint8_t len;
+} Stack;
+
+/* Everything the interpreter can change. The SDL front end (or a fuzzer, or
+   a replay) owns one of these and feeds it keys and timer ticks */
+typedef struct {
+  /* Memory; 'actual' memory starts at 0x200 = 512 = START_ADDR,
+     but all memory should be RW */
+  uint8_t mem[MEM_SIZE];
+
+  /* Registers, 16 of them, and they are 8-bit */
+  uint8_t reg[16];
+
+  Stack stack;
+
+  /* Program counter */
+  uint16_t pc;
+
+  /* 16-bit index register, points at locations in mem */
+  uint16_t ind;
+
+  /* Timers, 8 bit in size, should dec by 1 every Hz (60 times per second) */
+  uint8_t delay_timer;
+  /* TODO Sound timer should make computer beep while above 0, decs the same
+     way */
+  uint8_t sound_timer;
+
+  /* Keypad, bit n is set while key n is held */
+  uint16_t keys;
+
+  /* State of the xorshift generator behind CXNN, never 0 */
+  uint32_t rng;
+
+  /* Display pixels are on/off, one byte each, row after row */
+  uint8_t display[WIDTH * HEIGHT];
+
+  /* How many unknown instructions were executed (as no-ops), and the last
+     one */
+  uint32_t unknown;
+  uint16_t last_unknown;
+
+#ifdef DEBUGGER
+  /* One bit per address. Breakpoints stop before executing at pc,
+     watchpoints after FX33/FX55 stored to the address (see debug.c) */
+  uint64_t breakpoints[MEM_SIZE / 64];
+  uint64_t watchpoints[MEM_SIZE / 64];
+  uint8_t watch_hit;
+  uint16_t watch_addr;
+#endif
+} Chip8;
+
+#ifdef DEBUGGER
+static inline int bitmap_test(const uint64_t *map, uint16_t addr) {
+  return (map[addr >> 6] >> (addr & 63)) & 1;
+}
+#endif
+
+/* Zeroes everything, loads the font and sets pc to START_ADDR */
+void chip8_init(Chip8 *c, uint32_t seed);
+
+/* Fetches, decodes and executes one instruction. This is the reference
+   semantics every other core is fuzzed against (see tools/fuzz.c) */
+void chip8_step(Chip8 *c);
+
+/* Decrements the timers, call 60 times per second */
+void chip8_tick(Chip8 *c);
+
+/* FNV-1a, used to fingerprint ROMs and displays */
+uint64_t fnv1a64(const void *data, size_t len);
+
+void push_pc(uint16_t pc, Stack *st);
+uint16_t pop_pc(Stack *st);
@@ -0,0 +1,619 @@
+#ifdef DEBUGGER
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "debug.h"
+
+#define PACKET_MAX 4096
+
+/* Why the target stopped, as a GDB signal number */
+#define SIGINT_NR 2
+#define SIGTRAP_NR 5
+
+struct Debugger {
+  int fd;
+
+  /* Stop before the next instruction, with this signal (0 = don't) */
+  int stop_signal;
+  /* The stop GDB is waiting on a reply for. Not set for the initial stop,
+     GDB asks for that with '?' */
+  int reply_pending;
+  /* Watchpoint that fired for the current stop, -1 if none */
+  int watch_addr;
+
+  char rx[PACKET_MAX];
+  int rx_len;
+  int rx_pos;
+};
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static int hex_value(char ch) {
+  if (ch >= '0' && ch <= '9') {
+    return ch - '0';
+  }
+  if (ch >= 'a' && ch <= 'f') {
+    return ch - 'a' + 10;
+  }
+  if (ch >= 'A' && ch <= 'F') {
+    return ch - 'A' + 10;
+  }
+  return -1;
+}
+
+/* Parses hex up to the first non-hex char, *end points past it */
+static unsigned long parse_hex(const char *s, const char **end) {
+  unsigned long value = 0;
+  while (hex_value(*s) >= 0) {
+    value = value * 16 + hex_value(*s);
+    s++;
+  }
+  *end = s;
+  return value;
+}
+
+static char *put_hex(char *out, uint64_t value, int bytes) {
+  /* Little endian, like the register layout */
+  for (int i = 0; i < bytes; i++) {
+    uint8_t byte = value >> (8 * i);
+    *out++ = hex_digits[byte >> 4];
+    *out++ = hex_digits[byte & 0xF];
+  }
+  return out;
+}
+
+/* Reads bytes bytes of little endian hex, as put_hex writes them. Returns
+   NULL if they aren't all there or aren't hex, e.g. the "xx" GDB sends for
+   a register it has no value for */
+static const char *get_hex(const char *p, uint16_t *value, int bytes) {
+  *value = 0;
+  for (int i = 0; i < bytes; i++, p += 2) {
+    int hi = hex_value(p[0]);
+    int lo = hi < 0 ? -1 : hex_value(p[1]);
+    if (lo < 0) {
+      return NULL;
+    }
+    *value |= (hi * 16 + lo) << (8 * i);
+  }
+  return p;
+}
+
+/* -1 when GDB hung up */
+static int read_byte(Debugger *d) {
+  if (d->rx_pos == d->rx_len) {
+    ssize_t n = recv(d->fd, d->rx, sizeof d->rx, 0);
+    if (n <= 0) {
+      return -1;
+    }
+    d->rx_len = n;
+    d->rx_pos = 0;
+  }
+  return (uint8_t)d->rx[d->rx_pos++];
+}
+
+static void send_packet(Debugger *d, const char *data) {
+  char buf[PACKET_MAX + 8];
+  uint8_t sum = 0;
+  int len = 0;
+
+  buf[len++] = '$';
+  for (const char *p = data; *p && len < PACKET_MAX; p++) {
+    buf[len++] = *p;
+    sum += *p;
+  }
+  buf[len++] = '#';
+  buf[len++] = hex_digits[sum >> 4];
+  buf[len++] = hex_digits[sum & 0xF];
+
+  send(d->fd, buf, len, MSG_NOSIGNAL);
+}
+
+/* Reads the next packet into buf and acks it. Returns its length, or -1
+   when GDB hung up. A bare interrupt byte comes back as "\x03" */
+static int recv_packet(Debugger *d, char *buf) {
+  int ch;
+  while (1) {
+    do {
+      ch = read_byte(d);
+      if (ch == 0x03) {
+        buf[0] = 0x03;
+        buf[1] = '\0';
+        return 1;
+      }
+    } while (ch >= 0 && ch != '$');
+    if (ch < 0) {
+      return -1;
+    }
+
+    int len = 0;
+    uint8_t sum = 0;
+    while ((ch = read_byte(d)) >= 0 && ch != '#') {
+      if (len < PACKET_MAX - 1) {
+        buf[len++] = ch;
+      }
+      sum += ch;
+    }
+    int hi = read_byte(d);
+    int lo = read_byte(d);
+    if (ch < 0 || hi < 0 || lo < 0) {
+      return -1;
+    }
+    buf[len] = '\0';
+
+    if (hex_value(hi) * 16 + hex_value(lo) == sum) {
+      send(d->fd, "+", 1, MSG_NOSIGNAL);
+      return len;
+    }
+    send(d->fd, "-", 1, MSG_NOSIGNAL);
+  }
+}
+
+/* watch is the address of the watchpoint that fired, -1 if none did */
+static void send_stop(Debugger *d, int signal, int watch) {
+  char reply[64];
+  if (watch >= 0) {
+    snprintf(reply, sizeof reply, "T%02xwatch:%x;", signal, watch);
+  } else {
+    snprintf(reply, sizeof reply, "S%02x", signal);
+  }
+  send_packet(d, reply);
+}
+
+/* Register n, as numbered in the header, and its size in bytes */
+static int get_reg(const Chip8 *c, int n, uint16_t *value) {
+  if (n < 16) {
+    *value = c->reg[n];
+    return 1;
+  }
+  switch (n) {
+  case 16:
+    *value = c->ind;
+    return 2;
+  case 17:
+    *value = c->pc;
+    return 2;
+  case 18:
+    *value = c->stack.len;
+    return 1;
+  case 19:
+    *value = c->delay_timer;
+    return 1;
+  case 20:
+    *value = c->sound_timer;
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+static void set_reg(Chip8 *c, int n, uint16_t value) {
+  if (n < 16) {
+    c->reg[n] = value;
+    return;
+  }
+  switch (n) {
+  case 16:
+    c->ind = value & 0xFFF;
+    break;
+  case 17:
+    c->pc = value;
+    break;
+  case 18:
+    c->stack.len = value;
+    break;
+  case 19:
+    c->delay_timer = value;
+    break;
+  case 20:
+    c->sound_timer = value;
+    break;
+  }
+}
+
+#define N_REGS 21
+
+/* Bytes of registers in a 'g' reply, and that rounded up to whole 8-byte
+   slots. GDB reads the reply with the host's register layout and rejects
+   one that ends inside a register, so the rest is padded with "xx"
+   (unavailable) */
+#define REG_BYTES 23
+#define REG_PADDED 24
+
+/* One byte of the debugger's address space, -1 if nothing is there */
+static int peek(const Chip8 *c, unsigned long addr) {
+  if (addr < MEM_SIZE) {
+    return c->mem[addr];
+  }
+  if (addr >= DEBUG_STACK_ADDR &&
+      addr < DEBUG_STACK_ADDR + sizeof c->stack.stack) {
+    unsigned long offset = addr - DEBUG_STACK_ADDR;
+    return (c->stack.stack[offset / 2] >> (8 * (offset & 1))) & 0xFF;
+  }
+  return -1;
+}
+
+static int poke(Chip8 *c, unsigned long addr, uint8_t value) {
+  if (addr < MEM_SIZE) {
+    c->mem[addr] = value;
+    return 0;
+  }
+  if (addr >= DEBUG_STACK_ADDR &&
+      addr < DEBUG_STACK_ADDR + sizeof c->stack.stack) {
+    unsigned long offset = addr - DEBUG_STACK_ADDR;
+    uint16_t *entry = &c->stack.stack[offset / 2];
+    int shift = 8 * (offset & 1);
+    *entry = (*entry & ~(0xFF << shift)) | (value << shift);
+    return 0;
+  }
+  return -1;
+}
+
+static void set_bits(uint64_t *map, unsigned long addr, unsigned long len,
+                     int on) {
+  for (unsigned long a = addr; a < addr + len && a < MEM_SIZE; a++) {
+    if (on) {
+      map[a >> 6] |= (uint64_t)1 << (a & 63);
+    } else {
+      map[a >> 6] &= ~((uint64_t)1 << (a & 63));
+    }
+  }
+}
+
+/* Handles Z/z packets */
+static void breakpoint_packet(Debugger *d, Chip8 *c, const char *p) {
+  int on = p[0] == 'Z';
+  int type = p[1] - '0';
+  const char *end;
+  unsigned long addr = parse_hex(p + 3, &end);
+  unsigned long len = *end == ',' ? parse_hex(end + 1, &end) : 1;
+
+  switch (type) {
+  case 0:
+  case 1:
+    /* The kind is the instruction size, only the first byte counts */
+    set_bits(c->breakpoints, addr, 1, on);
+    break;
+  case 2:
+    set_bits(c->watchpoints, addr, len, on);
+    break;
+  default:
+    /* Read and access watchpoints would need checks in the load paths */
+    send_packet(d, "");
+    return;
+  }
+  send_packet(d, addr < MEM_SIZE ? "OK" : "E22");
+}
+
+/* Prints text in GDB's console, as an 'O' packet */
+static void console(Debugger *d, const char *text) {
+  char buf[PACKET_MAX];
+  char *out = buf;
+  *out++ = 'O';
+  for (; *text && out < buf + sizeof buf - 3; text++) {
+    out = put_hex(out, (uint8_t)*text, 1);
+  }
+  *out = '\0';
+  send_packet(d, buf);
+}
+
+/* Handles "monitor <command>" (qRcmd). GDB has no CHIP-8 architecture and
+   reads the 'g' reply with the host's register layout, so this is how the
+   registers and the stack are shown by name */
+static void monitor(Debugger *d, const Chip8 *c, const char *hex) {
+  char cmd[64];
+  int len = 0;
+  uint16_t ch;
+  while (len < (int)sizeof cmd - 1 && (hex = get_hex(hex, &ch, 1))) {
+    cmd[len++] = ch;
+  }
+  cmd[len] = '\0';
+
+  char line[128];
+  if (!strcmp(cmd, "regs")) {
+    for (int row = 0; row < 16; row += 8) {
+      char *out = line;
+      for (int n = row; n < row + 8; n++) {
+        out += sprintf(out, "V%X %02X%s", n, c->reg[n],
+                       n < row + 7 ? "  " : "\n");
+      }
+      console(d, line);
+    }
+    snprintf(line, sizeof line, "I %03X  PC %03X  SP %u  DT %u  ST %u\n",
+             c->ind, c->pc, c->stack.len, c->delay_timer, c->sound_timer);
+    console(d, line);
+  } else if (!strcmp(cmd, "stack")) {
+    snprintf(line, sizeof line, "%u return address%s%s\n", c->stack.len,
+             c->stack.len == 1 ? "" : "es",
+             c->stack.len ? ", innermost last:" : "");
+    console(d, line);
+    for (int i = 0; i < c->stack.len; i++) {
+      snprintf(line, sizeof line, "  %3d: %03X\n", i, c->stack.stack[i]);
+      console(d, line);
+    }
+  } else {
+    console(d, "monitor commands: regs, stack\n");
+  }
+  send_packet(d, "OK");
+}
+
+/* Serves GDB until it resumes the target. Returns 0 on kill or hang up */
+static int serve(Debugger *d, Chip8 *c) {
+  static char packet[PACKET_MAX];
+  static char reply[PACKET_MAX];
+
+  while (1) {
+    int len = recv_packet(d, packet);
+    if (len < 0) {
+      printf("debugger: GDB hung up\n");
+      return 0;
+    }
+
+    char *out = reply;
+    const char *end;
+    *out = '\0';
+
+    switch (packet[0]) {
+    case '?':
+      /* Why we are stopped right now, a watchpoint if one fired */
+      send_stop(d, SIGTRAP_NR, d->watch_addr);
+      continue;
+
+    case 'g':
+      for (int n = 0; n < N_REGS; n++) {
+        uint16_t value;
+        int size = get_reg(c, n, &value);
+        out = put_hex(out, value, size);
+      }
+      for (int i = REG_BYTES; i < REG_PADDED; i++) {
+        *out++ = 'x';
+        *out++ = 'x';
+      }
+      *out = '\0';
+      break;
+
+    case 'G': {
+      /* Parse everything first so a bad packet changes nothing. A short
+         one only sets the registers it covers */
+      uint16_t values[N_REGS];
+      const char *p = packet + 1;
+      int n = 0;
+      for (; n < N_REGS && p && *p; n++) {
+        uint16_t value;
+        p = get_hex(p, &values[n], get_reg(c, n, &value));
+      }
+      /* GDB sends the padding back, as "xx" or whatever it holds */
+      for (int i = REG_BYTES; n == N_REGS && p && *p && i < REG_PADDED; i++) {
+        int pad = (p[0] == 'x' && p[1] == 'x') ||
+                  (hex_value(p[0]) >= 0 && hex_value(p[1]) >= 0);
+        p = pad ? p + 2 : NULL;
+      }
+      if (!p || *p) {
+        strcpy(reply, "E00");
+        break;
+      }
+      for (int i = 0; i < n; i++) {
+        set_reg(c, i, values[i]);
+      }
+      strcpy(reply, "OK");
+      break;
+    }
+
+    case 'p':
+      /* GDB numbers registers by the host's layout and only asks with 'p'
+         for the ones past the end of the 'g' reply, which don't exist */
+      strcpy(reply, "xx");
+      break;
+
+    case 'P':
+      /* Same numbering problem. Leaving it unsupported makes GDB write
+         registers with 'G', in the layout above */
+      break;
+
+    case 'm': {
+      unsigned long addr = parse_hex(packet + 1, &end);
+      unsigned long count = parse_hex(end + 1, &end);
+      for (unsigned long i = 0; i < count && i < PACKET_MAX / 2 - 1; i++) {
+        int byte = peek(c, addr + i);
+        if (byte < 0) {
+          break;
+        }
+        out = put_hex(out, byte, 1);
+      }
+      *out = '\0';
+      if (out == reply) {
+        strcpy(reply, "E14");
+      }
+      break;
+    }
+
+    case 'M': {
+      unsigned long addr = parse_hex(packet + 1, &end);
+      unsigned long count = parse_hex(end + 1, &end);
+      const char *p = end + 1;
+      strcpy(reply, "OK");
+      for (unsigned long i = 0; i < count; i++) {
+        uint16_t byte;
+        p = get_hex(p, &byte, 1);
+        if (!p) {
+          strcpy(reply, "E00");
+          break;
+        }
+        if (poke(c, addr + i, byte) < 0) {
+          strcpy(reply, "E14");
+          break;
+        }
+      }
+      break;
+    }
+
+    case 'Z':
+    case 'z':
+      breakpoint_packet(d, c, packet);
+      continue;
+
+    case 'c':
+    case 's':
+      /* Resuming at a given address isn't supported, GDB doesn't need it */
+      d->stop_signal = packet[0] == 's' ? SIGTRAP_NR : 0;
+      d->reply_pending = 1;
+      return 1;
+
+    case 0x03:
+      /* Already stopped, and no watchpoint fired for this stop */
+      send_stop(d, SIGINT_NR, -1);
+      continue;
+
+    case 'D':
+      /* Detach, the ROM keeps running without breakpoints */
+      memset(c->breakpoints, 0, sizeof c->breakpoints);
+      memset(c->watchpoints, 0, sizeof c->watchpoints);
+      send_packet(d, "OK");
+      d->stop_signal = 0;
+      d->reply_pending = 0;
+      return 1;
+
+    case 'k':
+      return 0;
+
+    case 'q':
+      if (!strncmp(packet, "qSupported", 10)) {
+        snprintf(reply, sizeof reply, "PacketSize=%x", PACKET_MAX);
+      } else if (!strcmp(packet, "qAttached")) {
+        strcpy(reply, "1");
+      } else if (!strncmp(packet, "qRcmd,", 6)) {
+        monitor(d, c, packet + 6);
+        continue;
+      }
+      break;
+
+    default:
+      /* Empty reply means unsupported */
+      break;
+    }
+
+    send_packet(d, reply);
+  }
+}
+
+Debugger *debug_open(const char *where) {
+  int listener;
+
+  if (strchr(where, '/')) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(where) >= sizeof addr.sun_path) {
+      printf("debugger: socket path %s is too long\n", where);
+      return NULL;
+    }
+    strcpy(addr.sun_path, where);
+
+    /* Only replace a socket left over from an earlier run, never a ROM
+       or anything else passed by mistake */
+    struct stat st;
+    if (lstat(where, &st) == 0) {
+      if (!S_ISSOCK(st.st_mode)) {
+        printf("debugger: %s exists and isn't a socket\n", where);
+        return NULL;
+      }
+      unlink(where);
+    }
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+      perror("debugger: socket");
+      return NULL;
+    }
+    if (bind(listener, (struct sockaddr *)&addr, sizeof addr) < 0) {
+      perror(where);
+      close(listener);
+      return NULL;
+    }
+  } else {
+    char *end;
+    long port = strtol(where, &end, 10);
+    if (end == where || *end || port < 1 || port > 65535) {
+      printf("debugger: %s is neither a port (1-65535) nor a socket path\n",
+             where);
+      return NULL;
+    }
+
+    /* Only on loopback, anyone who can connect can poke memory */
+    struct sockaddr_in addr = {.sin_family = AF_INET,
+                               .sin_port = htons(port),
+                               .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    int yes = 1;
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) {
+      perror("debugger: socket");
+      return NULL;
+    }
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes);
+    if (bind(listener, (struct sockaddr *)&addr, sizeof addr) < 0) {
+      perror("debugger: bind");
+      close(listener);
+      return NULL;
+    }
+  }
+
+  if (listen(listener, 1) < 0) {
+    perror("debugger: listen");
+    close(listener);
+    return NULL;
+  }
+  printf("debugger: waiting for GDB on %s\n", where);
+
+  int fd = accept(listener, NULL, NULL);
+  close(listener);
+  if (fd < 0) {
+    perror("debugger: accept");
+    return NULL;
+  }
+
+  Debugger *d = calloc(1, sizeof *d);
+  d->fd = fd;
+  d->stop_signal = SIGTRAP_NR;
+  d->reply_pending = 0;
+  d->watch_addr = -1;
+  return d;
+}
+
+int debug_hook(Debugger *d, Chip8 *c) {
+  int signal = d->stop_signal;
+  if (c->watch_hit) {
+    signal = SIGTRAP_NR;
+  } else if (!signal && !bitmap_test(c->breakpoints, c->pc & 0xFFF)) {
+    return 1;
+  } else if (!signal) {
+    signal = SIGTRAP_NR;
+  }
+
+  d->watch_addr = c->watch_hit ? c->watch_addr : -1;
+  c->watch_hit = 0;
+
+  if (d->reply_pending) {
+    send_stop(d, signal, d->watch_addr);
+  }
+  d->reply_pending = 0;
+  return serve(d, c);
+}
+
+void debug_poll(Debugger *d) {
+  char ch;
+  while (recv(d->fd, &ch, 1, MSG_DONTWAIT) == 1) {
+    if (ch == 0x03) {
+      d->stop_signal = SIGINT_NR;
+    }
+  }
+}
+
+void debug_close(Debugger *d) {
+  close(d->fd);
+  free(d);
+}
+
+#endif
@@ -0,0 +1,37 @@
+#pragma once
+#ifdef DEBUGGER
+#include "core.h"
+
+/* GDB remote serial protocol stub, only built with -DDEBUGGER (make debug).
+
+   Registers, in 'g' packet order: V0-VF (1 byte each), I (2), PC (2),
+   SP (1), DT (1), ST (1); 16-bit ones little endian, then one "xx" byte to
+   fill whole 8-byte slots. 'G' takes the same layout, 'p' answers every
+   register as unavailable and 'P' is unsupported. Memory is at 0x0-0xFFF,
+   the call stack is readable as 16-bit little endian entries from
+   DEBUG_STACK_ADDR. Z0/Z1 set PC breakpoints, Z2 sets write watchpoints.
+   GDB has no CHIP-8 architecture and reads the registers with the host's
+   layout, "monitor regs" and "monitor stack" print them by name. */
+
+#define DEBUG_STACK_ADDR 0x10000
+
+typedef struct Debugger Debugger;
+
+/* where is a TCP port on 127.0.0.1, or a Unix socket path if it contains a
+   '/' (a stale socket there is replaced, any other file is an error).
+   Blocks until GDB connects; the target starts out stopped. Returns NULL
+   after printing why on failure */
+Debugger *debug_open(const char *where);
+
+/* Call before every instruction. Serves GDB while the target is stopped at
+   a breakpoint, a watchpoint hit or a single step. Returns 0 if GDB killed
+   the target or hung up */
+int debug_hook(Debugger *d, Chip8 *c);
+
+/* Checks (without blocking) whether GDB sent an interrupt, call once a
+   frame */
+void debug_poll(Debugger *d);
+
+void debug_close(Debugger *d);
+
+#endif
@@ -1,9 +1,7 @@
-#include <SDL3/SDL.h>
 #include <stdint.h>
-#include <stdio.h>
+#include <string.h>
 
-#define WIDTH 64
-#define HEIGHT 32
+#include "core.h"
 
 // nice blue 87, 216, 255
 // nice green 130, 255, 128
@@ -16,7 +14,7 @@
    and another 7 pixels to the right.
    return 1 IF ANY PIXELS WERE TURNED OFF (and set that to register 15, VF),
    else 0 */
-uint8_t draw(SDL_Surface *surface, uint8_t x_coord, uint8_t y_coord,
+uint8_t draw(uint8_t *display, uint8_t x_coord, uint8_t y_coord,
              uint8_t nibble_height, uint8_t *sprite_ptr) {
 
   /* Starting positions should modulo */
@@ -28,11 +26,6 @@ uint8_t draw(SDL_Surface *surface, uint8_t x_coord, uint8_t y_coord,
   uint8_t sprite_line = 0;
   uint8_t pixel_arr[8];
 
-  /* Pixels to pass into SDL_ReadSurfacePixel() */
-  uint8_t r;
-  uint8_t g;
-  uint8_t b;
-
   /* Coordinates + their offset */
   uint8_t adjusted_x;
   uint8_t adjusted_y;
@@ -60,15 +53,14 @@ uint8_t draw(SDL_Surface *surface, uint8_t x_coord, uint8_t y_coord,
       if (pixel_arr[x_offset]) {
 
         /* has_flipped was checked HERE, which is faulty! */
-        SDL_ReadSurfacePixel(surface, adjusted_x, adjusted_y, &r, &g, &b, NULL);
-        if ((r | g | g) == 0) {
+        uint8_t *pixel = &display[adjusted_y * WIDTH + adjusted_x];
+        if (*pixel == 0) {
           /* If pixel WAS off, flip to on */
-          SDL_WriteSurfacePixel(surface, adjusted_x, adjusted_y, 255, 255, 255,
-                                255);
+          *pixel = 1;
         } else {
           /* If pixel WAS on, flip to off, also set return bool */
           has_flipped = 1;
-          SDL_WriteSurfacePixel(surface, adjusted_x, adjusted_y, 0, 0, 0, 255);
+          *pixel = 0;
         }
       }
     }
@@ -77,6 +69,8 @@ uint8_t draw(SDL_Surface *surface, uint8_t x_coord, uint8_t y_coord,
   return has_flipped;
 }
 
+void clear_display(uint8_t *display) { memset(display, 0, WIDTH * HEIGHT); }
+
 void init_font(uint8_t *mem) {
   /* Lazy way to put a font in memory. Puts the font in the memory, starting at
    * the pointer */
@@ -3,30 +3,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
 
-#include "display.h"
-
-#define START_ADDR 0x200
-#define FIRST_NIBBLE 0xF000
-#define SECOND_NIBBLE 0x0F00
-#define THIRD_NIBBLE 0x00F0
-#define FOURTH_NIBBLE 0x000F
-#define SECOND_BYTE 0x00FF
-#define ADDR_NIBBLES 0x0FFF
+#include "core.h"
+#include "debug.h"
+#include "metrics.h"
+#include "movie.h"
+#include "rom.h"
 
 /* Instructions per second */
 #define CYCLES 700
 
-/* NOTE: CHIP-8 IS BIG ENDIAN */
-
-/* TODO There are several instructions that are ambiguous, meaning
-   they differ between modern and original behaviour.
-   One way to maintain (some sort of) compatability is to give the user
-   the option to change how they want it to behave.
-   This could for example be set with a CLI switch.
-
-   Perhaps I could assign relevant functions to function pointers? */
-
 uint8_t int_to_key(uint8_t key) {
   switch (key) {
   case 0x0:
@@ -66,45 +53,73 @@ uint8_t int_to_key(uint8_t key) {
   }
 }
 
-int compare_ts(struct timespec a, struct timespec b) {
-  if (a.tv_sec > b.tv_sec) {
-    return -1;
-  }
-  if (b.tv_sec > a.tv_sec) {
-    return 1;
-  }
-  if (a.tv_nsec > b.tv_nsec) {
-    return -1;
-  }
-  if (b.tv_nsec > a.tv_nsec) {
-    return 1;
-  }
-  return 0; // they are equal
+uint64_t ts_ns(struct timespec ts) {
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
-typedef struct {
-  uint16_t *stack;
-  uint8_t len;
-} Stack;
-
-Stack *new_stack() {
-  Stack *st = malloc(sizeof *st);
-  st->len = 0;
-  st->stack = calloc(128, sizeof *st->stack);
-
-  return st;
+/* Keypad state as the bitmask the core wants */
+uint16_t read_keys(void) {
+  const bool *state = SDL_GetKeyboardState(NULL);
+  uint16_t keys = 0;
+  for (int i = 0; i < 16; i++) {
+    if (state[int_to_key(i)]) {
+      keys |= 1 << i;
+    }
+  }
+  return keys;
 }
 
-/* Push program counter to stack */
-void push_pc(uint16_t pc, Stack *st) {
-  st->stack[st->len] = pc;
-  st->len++;
+/* Copies the core's on/off display into the RGBA32 surface */
+void render_display(SDL_Surface *surface, const uint8_t *display) {
+  SDL_LockSurface(surface);
+  for (int y = 0; y < HEIGHT; y++) {
+    uint32_t *row =
+        (uint32_t *)((uint8_t *)surface->pixels + y * surface->pitch);
+    for (int x = 0; x < WIDTH; x++) {
+      row[x] = display[y * WIDTH + x] ? 0xFFFFFFFF : 0xFF000000;
+    }
+  }
+  SDL_UnlockSurface(surface);
 }
 
-/* Pop program counter from stack */
-uint16_t pop_pc(Stack *st) {
-  st->len--;
-  return st->stack[st->len];
+/* Runs a movie headless on virtual time, as fast as the host allows, and
+   checks every frame's display against the recording. Returns 0 if all of
+   them match */
+int replay(Chip8 *chip, const RomInfo *info, FILE *movie,
+           const MovieHeader *header) {
+  MovieFrame frame;
+  uint64_t frames = 0;
+  uint64_t mismatches = 0;
+  uint64_t hash = fnv1a64(chip->display, sizeof chip->display);
+
+  while (movie_read_frame(movie, &frame)) {
+    chip->keys = frame.keys;
+    uint32_t n = movie_frame_cycles(header->cycles, frames);
+    for (uint32_t i = 0; i < n; i++) {
+      /* Jumping to itself until the tick, the rest of the frame is a no-op */
+      if (rom_is_idle(info, chip)) {
+        break;
+      }
+      chip8_step(chip);
+    }
+    chip8_tick(chip);
+
+    hash = fnv1a64(chip->display, sizeof chip->display);
+    if (hash != frame.display_hash) {
+      if (mismatches == 0) {
+        printf("frame %lu: display differs from the recording\n",
+               (unsigned long)frames);
+      }
+      mismatches++;
+    }
+    frames++;
+  }
+
+  printf("replayed %lu frames, %lu differ, final display 0x%016lx, "
+         "%u unknown instruction(s)\n",
+         (unsigned long)frames, (unsigned long)mismatches,
+         (unsigned long)hash, chip->unknown);
+  return mismatches ? 1 : 0;
 }
 
 int main(int argc, char **args) {
@@ -112,6 +127,107 @@ int main(int argc, char **args) {
 
   uint8_t is_running = 1;
 
+  /* -r records input to a movie, -p plays one back without a window,
+     -i prints what the ROM analysis found and exits,
+     -g waits for GDB on a port or Unix socket (debug builds only) */
+  const char *record_path = NULL;
+  const char *replay_path = NULL;
+  int print_info = 0;
+#ifdef DEBUGGER
+  const char *debug_where = NULL;
+  Debugger *debugger = NULL;
+  const char *options = "r:p:ig:";
+#else
+  const char *options = "r:p:i";
+#endif
+  int opt;
+  while ((opt = getopt(argc, args, options)) != -1) {
+    switch (opt) {
+    case 'r':
+      record_path = optarg;
+      break;
+    case 'p':
+      replay_path = optarg;
+      break;
+    case 'i':
+      print_info = 1;
+      break;
+#ifdef DEBUGGER
+    case 'g':
+      debug_where = optarg;
+      break;
+#endif
+    default:
+      printf("usage: %s [-r movie | -p movie | -i] rom\n", args[0]);
+      return -1;
+    }
+  }
+
+  if (optind >= argc) {
+    printf("no binary specified, exiting\n");
+    return -1;
+  }
+
+  /* Seed rng, a replay uses the seed of the recording */
+  MovieHeader header = {.seed = time(NULL), .cycles = CYCLES};
+  FILE *movie = NULL;
+  if (replay_path) {
+    movie = movie_open(replay_path, &header);
+    if (!movie) {
+      return -1;
+    }
+  }
+
+  /* All the interpreter state, see core.h */
+  Chip8 *chip = malloc(sizeof *chip);
+  chip8_init(chip, header.seed);
+
+  /* Load the binary passed as arg, then get what's known about it (idle
+     loops and so on) from the cache, or work it out */
+  uint64_t content_hash;
+  if (rom_load(chip, args[optind], &content_hash) < 0) {
+    return -1;
+  }
+  RomInfo *info = malloc(sizeof *info);
+  rom_info(chip, content_hash, info);
+
+  if (print_info) {
+    rom_print(info, content_hash);
+    free(info);
+    free(chip);
+    return 0;
+  }
+
+  if (movie) {
+    if (header.rom_hash != content_hash) {
+      printf("%s was recorded with a different ROM\n", replay_path);
+      return -1;
+    }
+    int result = replay(chip, info, movie, &header);
+    fclose(movie);
+    free(info);
+    free(chip);
+    return result;
+  }
+
+  if (record_path) {
+    header.rom_hash = content_hash;
+    movie = movie_create(record_path, &header);
+    if (!movie) {
+      return -1;
+    }
+  }
+
+#ifdef DEBUGGER
+  /* Before the window exists, this blocks until GDB connects */
+  if (debug_where) {
+    debugger = debug_open(debug_where);
+    if (!debugger) {
+      return -1;
+    }
+  }
+#endif
+
   /* SDL3 for graphics, sound and controls */
   SDL_Init(SDL_INIT_VIDEO);
   SDL_SetAppMetadata("Chip-8 Emulator", "0.1", NULL);
@@ -135,91 +251,49 @@ int main(int argc, char **args) {
      Another option is to make a texture, and make an array of SDL_FPoint,
      and drawing them as many as possible at a time with SDL_RenderPoints() */
 
-  /* Open binary file passed as arg */
-  FILE *f = NULL;
-  if (argc <= 1) {
-    printf("no binary specified, exiting\n");
-    return -1;
-  } else {
-    f = fopen(args[1], "rb");
-  }
-
-  /* Seed rng */
-  srand(time(NULL));
-
-  /* Memory; 'actual' memory starts at 0x200 = 512 = START_ADDR,
-                 but all memory should be RW */
-  uint8_t *mem = calloc(4096, sizeof *mem);
-  init_font(&mem[0x50]);
-
-  /* Saves addresses, this is way bigger than it was back then,
-     if I understand it correctly -- doesn't matter. Maybe it makes more
-     sense to have this as an array so it's, y'know, on the stack... */
-  Stack *stack = new_stack();
-
-  /* Registers, 16 of them, and they are 8-bit */
-  uint8_t *reg = calloc(16, sizeof *reg);
-
-  /* Program counter */
-  uint16_t pc = START_ADDR;
-
-  /* 16-bit index register, points at locations in mem */
-  uint16_t ind = 0;
-
-  /* Timers, 8 bit in size, should dec by 1 every Hz (60 times per second) */
-  uint8_t delay_timer = 0;
-  /* TODO Sound timer should make computer beep while above 0, decs the same way
-   */
-  uint8_t sound_timer = 0;
-
-  /* Read binary into memory
-     0 - 1FF was originally where the interpreter lived, so we
-     load the program past that */
-  uint16_t counter = START_ADDR;
-  uint8_t read_byte = 0;
-  while (counter < 4096) {
-    read_byte = fgetc(f);
-    // printf("byte: 0x%X -> mem[%d]\n", read_byte, counter);
-    mem[counter] = read_byte;
-    counter++;
-  }
-  fclose(f);
-  // printf("\nDEBUG: Binary successfully loaded into memory! -- File
-  // closed.\n");
-
   /* Main emulator loop:
            - Fetch instruction from memory at current pc
            - Decode instruction to figure out what to do
-           - Execute instruction */
-
-  uint16_t instruction = 0;
-  uint8_t first_nibble = 0;
-  uint8_t second_nibble = 0;
-  uint8_t third_nibble = 0;
-  uint8_t fourth_nibble = 0;
+           - Execute instruction
 
-  uint8_t *x_reg = NULL;
-  uint8_t *y_reg = NULL;
-  uint8_t number = 0;
-  uint8_t imm_number = 0;
-  uint16_t imm_addr = 0;
+     Timers tick after every movie_frame_cycles() instructions rather than
+     by the host clock, so a recording replays exactly. The instructions
+     themselves are paced to CYCLES per second, which keeps ticks at 60 Hz */
 
-  struct timespec cycle_start, sleep_until, delay_time, now;
+  struct timespec cycle_start, sleep_until, last_tick, now, sleep_start;
   long cycle_time_ns = 1e9 / CYCLES; // nanoseconds per cycle
 
   long delay_time_ns = 1e9 / 60; // a 60th of a second in ns
 
+  uint32_t unknown_seen = 0;
+  int idle_sleep = 0;
+  uint64_t frame = 0;
+  long frame_end = movie_frame_cycles(CYCLES, frame);
+  chip->keys = read_keys();
+
   clock_gettime(CLOCK_MONOTONIC, &now);
-  delay_time.tv_sec = now.tv_sec;
-  delay_time.tv_nsec = now.tv_nsec + delay_time_ns;
-  if (delay_time.tv_nsec >= 1e9) {
-    delay_time.tv_sec += 1;
-    delay_time.tv_nsec -= 1e9;
-  }
+  last_tick = now;
+
+  /* Metrics are counted locally and only copied to shared memory on timer
+     ticks, all the timestamps below are ones the loop takes anyway */
+  Metrics *metrics = metrics_open(CYCLES);
+  MetricsData stats = {0};
+  stats.start_ns = ts_ns(now);
+  sleep_start = now;
 
   while (is_running) {
 
     clock_gettime(CLOCK_MONOTONIC, &cycle_start);
+    if (ins > 0) {
+      uint64_t slept = ts_ns(cycle_start) - ts_ns(sleep_start);
+      stats.sleep_ns += slept;
+      /* A sleep through the rest of an idle frame isn't a sample of how
+         long one instruction's sleep takes */
+      if (!idle_sleep) {
+        metrics_sample(stats.sleep, slept);
+      }
+    }
+    idle_sleep = 0;
     sleep_until.tv_sec = cycle_start.tv_sec;
     sleep_until.tv_nsec = cycle_start.tv_nsec + cycle_time_ns;
 
@@ -228,360 +302,35 @@ int main(int argc, char **args) {
       sleep_until.tv_nsec -= 1e9;
     }
 
-    /* Read two bytes as one instruction, big endian */
-    instruction = (mem[pc] << 8) | (mem[pc + 1]);
-
-    /* Increase pc by two */
-    pc += 2;
-    if (pc >= 4096) {
-      /* Not entirely sure what should happen here, as the program
-       shouldn't overflow the program counter to begin with */
-      // exit(1);
-    }
-
-    /* Pick apart and carry out the instruction */
-
-    /* We decode by each nibble */
-    first_nibble = ((instruction & FIRST_NIBBLE) >> 12); // top of instruction
-    second_nibble = ((instruction & SECOND_NIBBLE) >> 8);
-    third_nibble = ((instruction & THIRD_NIBBLE) >> 4);
-    fourth_nibble = instruction & FOURTH_NIBBLE;
-
-    /* Depending on the instruction, any nibble or combination of nibbles
-                 past the first will carry some meaning. We pick apart all
-       possible meanings here, so we can use them easily */
-    x_reg = &reg[second_nibble];            // x register value
-    y_reg = &reg[third_nibble];             // y register value
-    number = instruction & FOURTH_NIBBLE;   // a 4-bit number
-    imm_number = instruction & SECOND_BYTE; // 8-bit immediate number
-    imm_addr = instruction & ADDR_NIBBLES;  // 12-bit immediate address
-
-    switch (first_nibble) {
-    case 0x0:
-      switch (fourth_nibble) {
-      case 0x0:
-        /* Clear display */
-        SDL_ClearSurface(surface, 0., 0., 0., 1.);
-        // SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer,
-        // surface);
-        // /* I think I need to set the scale mode every single time */
-        // SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST);
-        // SDL_RenderTexture(renderer, texture, NULL, NULL);
-        // SDL_RenderPresent(renderer);
-        // /* Free it! */
-        // SDL_DestroyTexture(texture);
-        break;
-
-      case 0xE:
-        /* Return from subroutine */
-        pc = pop_pc(stack);
-        break;
-      default:
-        printf("Unknown instruction 0x%X!\n", instruction);
-        break;
-      }
-      break;
-
-    case 0x1:
-      /* jump 1NNN (to imm_addr) */
-      pc = imm_addr;
-      break;
-
-    case 0x2:
-      /* push pc to stack and jump to subroutine */
-      push_pc(pc, stack);
-      pc = imm_addr;
-      break;
-
-    case 0x3:
-      // puts("if x ==...");
-      if (*x_reg == imm_number) {
-        pc += 2;
-      }
-      break;
-
-    case 0x4:
-      // puts("if x !=...");
-      if (*x_reg != imm_number) {
-        pc += 2;
-      }
-      break;
-
-    case 0x5:
-      // puts("if x == y...");
-      if (*x_reg == *y_reg) {
-        pc += 2;
-      }
-      break;
-
-    case 0x6:
-      // puts("x = imm");
-      *x_reg = imm_number;
+#ifdef DEBUGGER
+    if (debugger && !debug_hook(debugger, chip)) {
       break;
+    }
+#endif
 
-    case 0x7:
-      // puts("add x,#imm");
-      *x_reg += imm_number;
-      break;
-
-    case 0x8:
-      switch (fourth_nibble) {
-      case 0x0:
-        // set VX to value of VY
-        *x_reg = *y_reg;
-        break;
-      case 0x1:
-        // set VX to (VX | VY)
-        *x_reg = (*x_reg | *y_reg);
-        reg[0xF] = 0; // Original behaviour
-        break;
-      case 0x2:
-        // set VX to (VX & VY)
-        *x_reg = (*x_reg & *y_reg);
-        reg[0xF] = 0; // Original behaviour
-        break;
-      case 0x3:
-        // set VX to (VX ^ VY)
-        *x_reg = (*x_reg ^ *y_reg);
-        reg[0xF] = 0; // Original behaviour
-        break;
-      case 0x4:
-        /* add VY to VX, VY unaffected
-         should set VF if VX overflows */
-        if (*x_reg + *y_reg > 255) {
-          *x_reg += *y_reg;
-          reg[0xF] = 1;
-        } else {
-          *x_reg += *y_reg;
-          reg[0xF] = 0;
-        }
-        break;
-      case 0x5:
-        // VX = VX - VY
-        if (*x_reg >= *y_reg) {
-          *x_reg = *x_reg - *y_reg;
-          reg[0xF] = 1;
-        } else {
-          *x_reg = *x_reg - *y_reg;
-          reg[0xF] = 0;
-        }
-        break;
-      case 0x6:
-        // FIXME AMBIGUOUS, original for now
-        // VY into VX, then shift VX right
-        *x_reg = *y_reg;
-        if (*x_reg & 0x1) {
-          *x_reg >>= 1;
-          reg[0xF] = 1;
-        } else {
-          *x_reg >>= 1;
-          reg[0xF] = 0;
-        }
-        break;
-      case 0x7:
-        // VX = VY - VX
-        if (*y_reg >= *x_reg) {
-          *x_reg = *y_reg - *x_reg;
-          reg[0xF] = 1;
-        } else {
-          *x_reg = *y_reg - *x_reg;
-          reg[0xF] = 0;
-        }
-        break;
-      case 0xE:
-        // FIXME AMBIGUOUS, original for now
-        // VY into VX, then shift VX left
-        *x_reg = *y_reg;
-        if (*x_reg & 0x80) {
-          *x_reg <<= 1;
-          reg[0xF] = 1;
-        } else {
-          *x_reg <<= 1;
-          reg[0xF] = 0;
-        }
-        break;
-
-      default:
-        printf("Unknown instruction 0x%X!\n", instruction);
-        break;
-      }
-      break;
-
-    case 0x9:
-      // puts("if x != y...");
-      if (*x_reg != *y_reg) {
-        pc += 2;
-      }
-      break;
-
-    case 0xA:
-      // puts("mov ind,#addr");
-      ind = imm_addr;
-      break;
-
-    case 0xB:
-      // FIXME AMBIGUOUS, original for now, apparently more compatible??
-      // Jump to imm_addr + V0 (jump with offset)
-      pc = imm_addr + reg[0x0];
-      break;
-
-    case 0xC:
-      // Generate random number and & it with NN, assign to VX
-      *x_reg = rand() & imm_number;
-      break;
-
-    case 0xD:
-      /* Drawing, see function for info */
-      reg[0xF] = draw(surface, *x_reg, *y_reg, number, &mem[ind]);
-      // SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
-      // /* I think I need to set the scale mode every single time */
-      // SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST);
-      // SDL_RenderTexture(renderer, texture, NULL, NULL);
-      // SDL_RenderPresent(renderer);
-      // /* Free it! */
-      // SDL_DestroyTexture(texture);
-      break;
-
-    case 0xE:
-
-      SDL_PumpEvents();
-      const bool key_state =
-          SDL_GetKeyboardState(NULL)[int_to_key((*x_reg & 0xF))];
-
-      switch (fourth_nibble) {
-        /* Skips following instruction (i.e. increases PC) depending on
-           whether a key is being held -- can't implement until I have input */
-
-      case 0xE:
-        // skip if key in VX is held
-        if (key_state) {
-          pc += 2;
-        }
-        break;
-
-      case 0x1:
-        // skip if key in VX is NOT held
-        if (!key_state) {
-          pc += 2;
-        }
-        break;
-
-      default:
-        printf("Unknown instruction 0x%X!\n", instruction);
-        break;
-      }
-      break;
-
-    case 0xF:
-      /* This could also switch on imm_number, but that felt less readable
-       */
-      switch ((third_nibble << 4) | fourth_nibble) {
-      // switch (imm_number) {
-      case 0x07:
-        // Set VX to delay timer
-        *x_reg = delay_timer;
-        break;
-
-      case 0x15:
-        // Set delay timer to VX
-        delay_timer = *x_reg;
-        break;
-
-      case 0x18:
-        // Set sound timer to VX
-        sound_timer = *x_reg;
-        break;
-
-      case 0x1E:
-        /* add VX to index, sets non-standard "overflow" flag but should be
-           safe, see "Add to index" in the guide */
-        if ((ind + *x_reg) > 0xFFF) {
-          ind = (ind + *x_reg) & 0xFFF;
-          reg[0xF] = 1;
-        } else {
-          ind = (ind + *x_reg) & 0xFFF;
-          reg[0xF] = 0;
-        }
-        break;
-
-      case 0x0A:
-        /* wait (block) until key, put key in VX. timers should still move.
-           on the original cosmac vip, it was PRESS AND RELEASE. but just
-           press is likely fine. */
-
-        pc -= 2;
-        for (int i = 0; i < 16; i++) {
-          /* This might be faulty logic! This gets any key, even if it was
-           * already held (i.e., isn't a new key)*/
-          if (SDL_GetKeyboardState(NULL)[int_to_key(i)]) {
-            *x_reg = i;
-            /* We got a key, so we inc the program counter again so
-               we break out of the instruction loop and continue to the
-               next */
-            pc += 2;
-            break;
-          }
-        }
-        break;
-
-      case 0x29:
-        /* set ind to point at hexadecimal char in VX. Font starts at 0x50,
-           and each character is a 5-byte sequence. I may not need to mask
-           for the last nibble here, but I doubt it's a performance hit
-           even if it's unnecessary... */
-        ind = 0x50 + (*x_reg & 0xF) * 5;
-        break;
-
-      case 0x33:
-        /* Take number from VX (0-255 because 8 bits) and get 3 decimal
-           numbers, e.g. 159 would be 1, 5, 9 (division and modulo for
-           this). Store result in mem[ind], mem[ind+1], mem[ind+2] */
-
-        mem[ind] = *x_reg / 100;
-        mem[(ind + 1) & 0xFFF] = (*x_reg % 100) / 10;
-        mem[(ind + 2) & 0xFFF] = (*x_reg) % 10;
-        break;
-
-      case 0x55:
-        /* Store registers V0 through VX (inclusive) to memory, starting at
-        ind */
-        // printf("0xFX55 instruction, *x_reg is: %d\nind is 0x%X\n", *x_reg,
-        // ind);
-        for (int i = 0; i <= second_nibble; i++) {
-          // puts("inside loop!");
-          // if (i > 15) {
-          //   printf("x_reg = %p, *x_reg = %d\n", x_reg, *x_reg);
-          // }
-          mem[ind] = reg[i];
-          ind = (ind + 1) & 0xFFF;
-        }
-        break;
-
-      case 0x65:
-        // Opposite of last, loads registers from memory
-
-        // printf("0xFX65 instruction, *x_reg is: %d\n", *x_reg);
-        for (int i = 0; i <= second_nibble; i++) {
-          // printf("inside 0xFX65; ind = %X, i = %d, saving reg[%d] ->
-          // mem[%X]\n",
-          // ind, i, i, ind);
-          reg[i] = mem[ind];
-          ind = (ind + 1) & 0xFFF;
-        }
-        break;
+    /* Fetch, decode and execute, see core.c */
+    chip8_step(chip);
+    if (chip->unknown != unknown_seen) {
+      printf("Unknown instruction 0x%X!\n", chip->last_unknown);
+      unknown_seen = chip->unknown;
+    }
 
-      default:
-        printf("Unknown instruction 0x%X!\n", instruction);
-        break;
+    /* Spinning on a jump to itself: nothing changes until the timer tick,
+       so count the rest of the frame as done and sleep through it in one
+       go instead of waking up for every instruction */
+    if (rom_is_idle(info, chip) && ins + 1 < frame_end) {
+      long skipped = frame_end - (ins + 1);
+      ins += skipped;
+      stats.idle_skipped += skipped;
+      idle_sleep = 1;
+      sleep_until.tv_nsec += skipped * cycle_time_ns;
+      while (sleep_until.tv_nsec >= 1e9) {
+        sleep_until.tv_sec += 1;
+        sleep_until.tv_nsec -= 1e9;
       }
-      break;
-
-    default:
-      printf("Unknown instruction 0x%X!\n", instruction);
-      break;
     }
 
-    /* Past the big switch, we handle SDL events? */
+    /* Past the instruction, we handle SDL events? */
 
     SDL_Event event;
 
@@ -602,25 +351,47 @@ int main(int argc, char **args) {
       }
     }
 
-    /* DEC TIMERS BY 1 EVERY 60th OF A SECOND */
-    clock_gettime(CLOCK_MONOTONIC, &now);
+    ins++;
+    stats.instructions++;
 
-    if (compare_ts(now, delay_time) == -1) {
-      if (sound_timer > 0) {
-        sound_timer -= 1;
-      }
-      if (delay_timer > 0) {
-        delay_timer -= 1;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    sleep_start = now;
+
+    /* DEC TIMERS BY 1 EVERY 60th OF A SECOND (of emulated time) */
+    if (ins == frame_end) {
+      /* Jitter is how far the tick interval is from a 60th of a second */
+      int64_t interval = ts_ns(now) - ts_ns(last_tick);
+      metrics_sample(stats.tick_jitter, llabs(interval - delay_time_ns));
+      last_tick = now;
+      stats.ticks++;
+
+      chip8_tick(chip);
+
+      if (movie) {
+        MovieFrame recorded = {
+            .keys = chip->keys,
+            .display_hash = fnv1a64(chip->display, sizeof chip->display)};
+        if (movie_write_frame(movie, &recorded) < 0) {
+          perror(record_path);
+          printf("stopped recording after %lu frames\n", (unsigned long)frame);
+          fclose(movie);
+          movie = NULL;
+        }
       }
 
-      clock_gettime(CLOCK_MONOTONIC, &now);
-      delay_time.tv_sec = now.tv_sec;
-      delay_time.tv_nsec = now.tv_nsec + delay_time_ns;
-      if (delay_time.tv_nsec >= 1e9) {
-        delay_time.tv_sec += 1;
-        delay_time.tv_nsec -= 1e9;
+      /* Keys only change between frames, polling above updated SDL's
+         keyboard state */
+      frame++;
+      frame_end += movie_frame_cycles(CYCLES, frame);
+      chip->keys = read_keys();
+
+#ifdef DEBUGGER
+      if (debugger) {
+        debug_poll(debugger);
       }
+#endif
 
+      render_display(surface, chip->display);
       SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
       /* I think I need to set the scale mode every single time */
       SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST);
@@ -628,13 +399,14 @@ int main(int argc, char **args) {
       SDL_RenderPresent(renderer);
       /* Free it! */
       SDL_DestroyTexture(texture);
-    }
 
-    // ins++;
-    // if (ins == 317) {
-    //   puts("0xF165");
-    // }
-    // printf("DEBUG: Instruction #%lo, 0x%X\n", ins, instruction);
+      clock_gettime(CLOCK_MONOTONIC, &sleep_start);
+      metrics_sample(stats.present, ts_ns(sleep_start) - ts_ns(now));
+      if (metrics) {
+        stats.updated_ns = ts_ns(sleep_start);
+        metrics_publish(metrics, &stats);
+      }
+    }
 
     /* LIMIT SPEED: roughly 700 instructions per second -> 1/700 seconds per
      * instruction */
@@ -643,6 +415,22 @@ int main(int argc, char **args) {
     /* TODO PLAY BEEP WHILE SOUND TIMER ISN'T 0 */
   }
 
+#ifdef DEBUGGER
+  if (debugger) {
+    debug_close(debugger);
+  }
+#endif
+  /* Buffered frames only hit the disk here, so this can fail too */
+  if (movie && fclose(movie) != 0) {
+    perror(record_path);
+  }
+  if (metrics) {
+    metrics_close(metrics);
+  }
+
+  free(info);
+  free(chip);
+  SDL_DestroySurface(surface);
   SDL_DestroyWindow(window);
   SDL_DestroyRenderer(renderer);
   SDL_Quit();
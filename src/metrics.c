@@ -0,0 +1,118 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+static void shm_name(char *buf, size_t len, int pid) {
+  snprintf(buf, len, "/" METRICS_PREFIX "%d", pid);
+}
+
+Metrics *metrics_open(uint32_t cycles) {
+  char name[64];
+  shm_name(name, sizeof name, getpid());
+
+  int fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror("metrics: shm_open");
+    return NULL;
+  }
+  if (ftruncate(fd, sizeof(Metrics)) < 0) {
+    perror("metrics: ftruncate");
+    close(fd);
+    shm_unlink(name);
+    return NULL;
+  }
+
+  Metrics *m =
+      mmap(NULL, sizeof(Metrics), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (m == MAP_FAILED) {
+    perror("metrics: mmap");
+    shm_unlink(name);
+    return NULL;
+  }
+
+  /* ftruncate zero-fills, so only the header needs setting. magic goes last
+     so a reader never sees a half-initialised segment as valid */
+  m->version = METRICS_VERSION;
+  m->pid = getpid();
+  m->cycles = cycles;
+  atomic_store_explicit(&m->seq, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  m->magic = METRICS_MAGIC;
+
+  return m;
+}
+
+/* Copies the emulator's private counters into the segment. The emulator
+   accumulates into a local MetricsData and only calls this once per timer
+   tick, so the cost per instruction is a few plain increments */
+void metrics_publish(Metrics *m, const MetricsData *local) {
+  uint32_t seq = atomic_load_explicit(&m->seq, memory_order_relaxed);
+
+  atomic_store_explicit(&m->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  memcpy(&m->data, local, sizeof m->data);
+
+  atomic_store_explicit(&m->seq, seq + 2, memory_order_release);
+}
+
+void metrics_close(Metrics *m) {
+  char name[64];
+  shm_name(name, sizeof name, m->pid);
+  munmap(m, sizeof(Metrics));
+  shm_unlink(name);
+}
+
+const Metrics *metrics_attach(const char *name) {
+  char path[300];
+  snprintf(path, sizeof path, "/%s", name);
+
+  int fd = shm_open(path, O_RDONLY, 0);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  /* Don't map something smaller than we expect, e.g. an older layout */
+  if (lseek(fd, 0, SEEK_END) < (off_t)sizeof(Metrics)) {
+    close(fd);
+    return NULL;
+  }
+
+  const Metrics *m = mmap(NULL, sizeof(Metrics), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (m == MAP_FAILED) {
+    return NULL;
+  }
+  if (m->magic != METRICS_MAGIC || m->version != METRICS_VERSION) {
+    munmap((void *)m, sizeof(Metrics));
+    return NULL;
+  }
+  return m;
+}
+
+void metrics_detach(const Metrics *m) { munmap((void *)m, sizeof(Metrics)); }
+
+int metrics_snapshot(const Metrics *m, MetricsData *out) {
+  /* The writer updates at 60 Hz, so a handful of retries is plenty; if it
+     still isn't stable the writer probably died mid-update */
+  for (int tries = 0; tries < 1000; tries++) {
+    uint32_t before = atomic_load_explicit(&m->seq, memory_order_acquire);
+    if (before & 1) {
+      continue;
+    }
+
+    memcpy(out, &m->data, sizeof *out);
+
+    atomic_thread_fence(memory_order_acquire);
+    uint32_t after = atomic_load_explicit(&m->seq, memory_order_relaxed);
+    if (before == after) {
+      return 0;
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <stdatomic.h>
+#include <stdint.h>
+
+/* Live counters, published to /dev/shm/chip8-<pid> so chip8-top can read them
+   from another process. Histograms are log2 buckets of nanoseconds, i.e.
+   bucket n counts samples in [2^n, 2^(n+1)) ns, bucket 0 also holds 0 ns. */
+
+#define METRICS_MAGIC 0x4d384343 // "CC8M"
+#define METRICS_VERSION 2
+#define METRICS_BUCKETS 32
+#define METRICS_PREFIX "chip8-"
+
+typedef struct {
+  uint64_t instructions; // executed instructions, total
+  uint64_t idle_skipped; // not executed because pc sat in an idle loop
+  uint64_t ticks;        // 60 Hz timer ticks (and presents), total
+  uint64_t sleep_ns;     // total time spent in clock_nanosleep
+  uint64_t start_ns;     // CLOCK_MONOTONIC when the emulator started
+  uint64_t updated_ns;   // CLOCK_MONOTONIC at last publish
+
+  uint64_t tick_jitter[METRICS_BUCKETS]; // how late each timer tick was
+  uint64_t present[METRICS_BUCKETS];     // texture upload + present
+  uint64_t sleep[METRICS_BUCKETS];       // each per-instruction sleep
+} MetricsData;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  int32_t pid;
+  uint32_t cycles; // target instructions per second
+
+  /* Seqlock: odd while the writer is in the middle of an update */
+  _Atomic uint32_t seq;
+
+  MetricsData data;
+} Metrics;
+
+/* Writer side. Returns NULL (and the emulator just runs without metrics) if
+   the segment can't be created */
+Metrics *metrics_open(uint32_t cycles);
+void metrics_publish(Metrics *m, const MetricsData *local);
+void metrics_close(Metrics *m);
+
+/* Adds one sample to a histogram, no syscalls */
+static inline void metrics_sample(uint64_t *hist, uint64_t ns) {
+  int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+  if (bucket >= METRICS_BUCKETS) {
+    bucket = METRICS_BUCKETS - 1;
+  }
+  hist[bucket]++;
+}
+
+/* Reader side. Maps an existing segment read-only by its /dev/shm name */
+const Metrics *metrics_attach(const char *name);
+void metrics_detach(const Metrics *m);
+/* Copies a consistent snapshot out of the segment, returns 0 on success */
+int metrics_snapshot(const Metrics *m, MetricsData *out);
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "movie.h"
+
+static void put_le(uint8_t *buf, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    buf[i] = value >> (8 * i);
+  }
+}
+
+static uint64_t get_le(const uint8_t *buf, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; i++) {
+    value |= (uint64_t)buf[i] << (8 * i);
+  }
+  return value;
+}
+
+FILE *movie_create(const char *path, const MovieHeader *header) {
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    perror(path);
+    return NULL;
+  }
+
+  uint8_t buf[24];
+  memcpy(buf, "C8MV", 4);
+  put_le(&buf[4], MOVIE_VERSION, 4);
+  put_le(&buf[8], header->seed, 4);
+  put_le(&buf[12], header->cycles, 4);
+  put_le(&buf[16], header->rom_hash, 8);
+  if (fwrite(buf, sizeof buf, 1, f) != 1) {
+    perror(path);
+    fclose(f);
+    return NULL;
+  }
+  return f;
+}
+
+FILE *movie_open(const char *path, MovieHeader *header) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return NULL;
+  }
+
+  uint8_t buf[24];
+  if (fread(buf, sizeof buf, 1, f) != 1 || memcmp(buf, "C8MV", 4)) {
+    printf("%s: not a movie\n", path);
+    fclose(f);
+    return NULL;
+  }
+  if (get_le(&buf[4], 4) != MOVIE_VERSION) {
+    printf("%s: unsupported movie version %u\n", path,
+           (unsigned)get_le(&buf[4], 4));
+    fclose(f);
+    return NULL;
+  }
+
+  header->seed = get_le(&buf[8], 4);
+  header->cycles = get_le(&buf[12], 4);
+  header->rom_hash = get_le(&buf[16], 8);
+  return f;
+}
+
+int movie_write_frame(FILE *f, const MovieFrame *frame) {
+  uint8_t buf[10];
+  put_le(&buf[0], frame->keys, 2);
+  put_le(&buf[2], frame->display_hash, 8);
+  return fwrite(buf, sizeof buf, 1, f) == 1 ? 0 : -1;
+}
+
+int movie_read_frame(FILE *f, MovieFrame *frame) {
+  uint8_t buf[10];
+  if (fread(buf, sizeof buf, 1, f) != 1) {
+    return 0;
+  }
+  frame->keys = get_le(&buf[0], 2);
+  frame->display_hash = get_le(&buf[2], 8);
+  return 1;
+}
+
+uint32_t movie_frame_cycles(uint32_t cycles, uint64_t frame) {
+  return (frame + 1) * cycles / 60 - frame * cycles / 60;
+}
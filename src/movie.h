@@ -0,0 +1,38 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+
+/* Input movies: everything needed to replay a run exactly, without a window
+   or the host clock. Time is virtual, a frame is one 60 Hz timer tick and
+   runs movie_frame_cycles() instructions. Within a frame the keys are
+   fixed, then the instructions run, then the timers tick.
+
+   File layout, little endian:
+     "C8MV", u32 version, u32 seed, u32 cycles, u64 rom hash
+   followed by one record per frame until the end of the file:
+     u16 keys, u64 display hash (after the frame's timer tick) */
+
+#define MOVIE_VERSION 2
+
+typedef struct {
+  uint32_t seed;     // what chip8_init() was seeded with
+  uint32_t cycles;   // instructions per second
+  uint64_t rom_hash; // fnv1a64 of the ROM file, as rom_load() returns it
+} MovieHeader;
+
+typedef struct {
+  uint16_t keys;
+  uint64_t display_hash;
+} MovieFrame;
+
+/* Both return NULL (after printing why) on failure */
+FILE *movie_create(const char *path, const MovieHeader *header);
+FILE *movie_open(const char *path, MovieHeader *header);
+
+int movie_write_frame(FILE *f, const MovieFrame *frame);
+/* 1 if a frame was read, 0 at the end of the movie */
+int movie_read_frame(FILE *f, MovieFrame *frame);
+
+/* How many instructions frame n runs, spreading the remainder of
+   cycles / 60 so every second runs exactly cycles instructions */
+uint32_t movie_frame_cycles(uint32_t cycles, uint64_t frame);
@@ -0,0 +1,311 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rom.h"
+
+/* Bump when the analysis changes, old cache files are then ignored */
+#define CACHE_VERSION 2
+
+int rom_load(Chip8 *c, const char *path, uint64_t *hash) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  if (st.st_size == 0 || st.st_size > ROM_MAX) {
+    printf("%s: %ld bytes, a ROM has to be 1-%d bytes\n", path,
+           (long)st.st_size, ROM_MAX);
+    close(fd);
+    return -1;
+  }
+
+  const uint8_t *rom = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (rom == MAP_FAILED) {
+    perror(path);
+    return -1;
+  }
+
+  /* 0 - 1FF was originally where the interpreter lived, so we
+     load the program past that. The rest of memory stays zeroed */
+  memcpy(&c->mem[START_ADDR], rom, st.st_size);
+  *hash = fnv1a64(rom, st.st_size);
+
+  munmap((void *)rom, st.st_size);
+  return 0;
+}
+
+/* Instruction classes, only used to follow the control flow */
+enum {
+  OP_UNKNOWN,
+  OP_CLS,
+  OP_RET,
+  OP_JP,
+  OP_CALL,
+  OP_SE_IMM,
+  OP_SNE_IMM,
+  OP_SE_REG,
+  OP_LD_IMM,
+  OP_ADD_IMM,
+  OP_ALU, // 8XYN
+  OP_SNE_REG,
+  OP_LD_I,
+  OP_JP_V0,
+  OP_RND,
+  OP_DRW,
+  OP_SKP,
+  OP_SKNP,
+  OP_MISC, // FXNN
+};
+
+static uint8_t decode(uint16_t ins) {
+  switch (ins >> 12) {
+  case 0x0:
+    /* Same as the core, only the last nibble is looked at */
+    switch (ins & 0xF) {
+    case 0x0:
+      return OP_CLS;
+    case 0xE:
+      return OP_RET;
+    default:
+      return OP_UNKNOWN;
+    }
+  case 0x1:
+    return OP_JP;
+  case 0x2:
+    return OP_CALL;
+  case 0x3:
+    return OP_SE_IMM;
+  case 0x4:
+    return OP_SNE_IMM;
+  case 0x5:
+    return OP_SE_REG;
+  case 0x6:
+    return OP_LD_IMM;
+  case 0x7:
+    return OP_ADD_IMM;
+  case 0x8:
+    return OP_ALU;
+  case 0x9:
+    return OP_SNE_REG;
+  case 0xA:
+    return OP_LD_I;
+  case 0xB:
+    return OP_JP_V0;
+  case 0xC:
+    return OP_RND;
+  case 0xD:
+    return OP_DRW;
+  case 0xE:
+    switch (ins & 0xF) {
+    case 0xE:
+      return OP_SKP;
+    case 0x1:
+      return OP_SKNP;
+    default:
+      return OP_UNKNOWN;
+    }
+  default:
+    return OP_MISC;
+  }
+}
+
+/* Follows every path from START_ADDR. BNNN and returns end a path, since
+   where they go depends on registers and the stack. Unknown instructions
+   don't, the core skips over them */
+static void analyse(const Chip8 *c, RomInfo *info) {
+  memset(info, 0, sizeof *info);
+
+  static uint16_t todo[MEM_SIZE];
+  int n_todo = 0;
+  todo[n_todo++] = START_ADDR;
+
+  while (n_todo > 0) {
+    uint16_t addr = todo[--n_todo];
+
+    while (addr < MEM_SIZE - 1 && !(info->map[addr] & ROM_CODE)) {
+      uint16_t ins = (c->mem[addr] << 8) | c->mem[addr + 1];
+      uint16_t nnn = ins & 0xFFF;
+      uint8_t op = decode(ins);
+
+      info->map[addr] |= ROM_CODE;
+      info->map[addr + 1] |= ROM_CODE;
+      info->code_bytes += 2;
+
+      if (op == OP_RET || op == OP_JP_V0) {
+        if (op == OP_JP_V0) {
+          info->quirks |= QUIRK_JUMP;
+        }
+        break;
+      }
+
+      if (op == OP_JP) {
+        info->map[nnn] |= ROM_TARGET;
+        if (nnn == addr) {
+          info->map[addr] |= ROM_IDLE;
+          break;
+        }
+        addr = nnn;
+        continue;
+      }
+
+      if (op == OP_CALL) {
+        info->map[nnn] |= ROM_TARGET;
+        if (n_todo < MEM_SIZE) {
+          todo[n_todo++] = nnn;
+        }
+      } else if (op == OP_SE_IMM || op == OP_SNE_IMM || op == OP_SE_REG ||
+                 op == OP_SNE_REG || op == OP_SKP || op == OP_SKNP) {
+        if (n_todo < MEM_SIZE) {
+          todo[n_todo++] = addr + 4;
+        }
+      } else if (op == OP_LD_I) {
+        info->map[nnn] |= ROM_DATA;
+      } else if (op == OP_ALU) {
+        uint8_t n = ins & 0xF;
+        if (n >= 0x1 && n <= 0x3) {
+          info->quirks |= QUIRK_LOGIC_VF;
+        } else if (n == 0x6 || n == 0xE) {
+          info->quirks |= QUIRK_SHIFT;
+        }
+      } else if (op == OP_MISC) {
+        uint8_t nn = ins & 0xFF;
+        if (nn == 0x55 || nn == 0x65) {
+          info->quirks |= QUIRK_LOAD;
+        }
+      }
+
+      addr += 2;
+    }
+  }
+}
+
+/* $XDG_CACHE_HOME/chip8, or ~/.cache/chip8. Returns 0 if there is nowhere
+   to cache */
+static int cache_dir(char *buf, size_t len) {
+  const char *base = getenv("XDG_CACHE_HOME");
+  if (base && *base) {
+    snprintf(buf, len, "%s/chip8", base);
+    return 1;
+  }
+  base = getenv("HOME");
+  if (base && *base) {
+    snprintf(buf, len, "%s/.cache/chip8", base);
+    return 1;
+  }
+  return 0;
+}
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t size; // sizeof(RomInfo), guards against a different build
+  uint32_t pad;
+  uint64_t hash;
+} CacheHeader;
+
+static int cache_read(const char *path, uint64_t hash, RomInfo *info) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return -1;
+  }
+
+  CacheHeader h;
+  int ok = fread(&h, sizeof h, 1, f) == 1 && !memcmp(h.magic, "C8AN", 4) &&
+           h.version == CACHE_VERSION && h.size == sizeof *info &&
+           h.hash == hash && fread(info, sizeof *info, 1, f) == 1;
+  fclose(f);
+  return ok ? 0 : -1;
+}
+
+/* Writes to a temporary file and renames it into place, so parallel runs
+   of the same ROM never see half a cache file */
+static void cache_write(const char *dir, const char *path, uint64_t hash,
+                        const RomInfo *info) {
+  char parent[4096];
+  snprintf(parent, sizeof parent, "%s", dir);
+  char *slash = strrchr(parent, '/');
+  if (slash && slash != parent) {
+    *slash = '\0';
+    mkdir(parent, 0755);
+  }
+  if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+    return;
+  }
+
+  char tmp[4224];
+  snprintf(tmp, sizeof tmp, "%s.%d.tmp", path, (int)getpid());
+  FILE *f = fopen(tmp, "wb");
+  if (!f) {
+    return;
+  }
+
+  CacheHeader h = {{'C', '8', 'A', 'N'}, CACHE_VERSION, sizeof *info, 0, hash};
+  int ok = fwrite(&h, sizeof h, 1, f) == 1 &&
+           fwrite(info, sizeof *info, 1, f) == 1;
+  if (fclose(f) != 0 || !ok || rename(tmp, path) < 0) {
+    unlink(tmp);
+  }
+}
+
+void rom_info(const Chip8 *c, uint64_t hash, RomInfo *info) {
+  char dir[4096];
+  char path[4200];
+  int cacheable = cache_dir(dir, sizeof dir);
+
+  if (cacheable) {
+    snprintf(path, sizeof path, "%s/%016llx.c8a", dir,
+             (unsigned long long)hash);
+    if (cache_read(path, hash, info) == 0) {
+      return;
+    }
+  }
+
+  analyse(c, info);
+
+  if (cacheable) {
+    cache_write(dir, path, hash, info);
+  }
+}
+
+void rom_print(const RomInfo *info, uint64_t hash) {
+  int data = 0;
+  int targets = 0;
+  for (int addr = 0; addr < MEM_SIZE; addr++) {
+    data += (info->map[addr] & ROM_DATA) != 0;
+    targets += (info->map[addr] & ROM_TARGET) != 0;
+  }
+
+  printf("hash %016llx: %u code bytes, %d data pointers, %d jump targets\n",
+         (unsigned long long)hash, info->code_bytes, data, targets);
+
+  printf("ambiguous instructions used:%s%s%s%s%s\n",
+         info->quirks & QUIRK_LOGIC_VF ? " 8XY1-3" : "",
+         info->quirks & QUIRK_SHIFT ? " 8XY6/8XYE" : "",
+         info->quirks & QUIRK_JUMP ? " BNNN" : "",
+         info->quirks & QUIRK_LOAD ? " FX55/FX65" : "",
+         info->quirks ? "" : " none");
+
+  printf("idle loops:");
+  int idle = 0;
+  for (int addr = 0; addr < MEM_SIZE; addr++) {
+    if (info->map[addr] & ROM_IDLE) {
+      printf(" %03X", addr);
+      idle++;
+    }
+  }
+  printf("%s\n", idle ? "" : " none");
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <stdint.h>
+
+#include "core.h"
+
+/* Largest ROM that fits between START_ADDR and the end of memory */
+#define ROM_MAX (MEM_SIZE - START_ADDR)
+
+/* Flags in RomInfo.map, one byte per memory address */
+#define ROM_CODE 0x1   // reachable as an instruction from START_ADDR
+#define ROM_DATA 0x2   // pointed at by ANNN, so sprite or FX65 data
+#define ROM_TARGET 0x4 // target of a jump or call
+#define ROM_IDLE 0x8   // 1NNN jumping to itself, nothing happens until a tick
+
+/* Ambiguous instructions (see the TODO in core.c) the reachable code uses,
+   i.e. which quirks this ROM is sensitive to */
+#define QUIRK_LOGIC_VF 0x1 // 8XY1/8XY2/8XY3 reset VF
+#define QUIRK_SHIFT 0x2    // 8XY6/8XYE shift VY, not VX
+#define QUIRK_JUMP 0x4     // BNNN adds V0, not VX
+#define QUIRK_LOAD 0x8     // FX55/FX65 move ind
+
+/* Everything worked out about a ROM before running it. Only depends on the
+   ROM's contents, so it is cached by content hash */
+typedef struct {
+  uint32_t quirks;
+  uint32_t code_bytes;
+  uint8_t map[MEM_SIZE];
+} RomInfo;
+
+/* Copies the ROM at path into mem at START_ADDR and hashes it. Returns 0,
+   or -1 after printing why */
+int rom_load(Chip8 *c, const char *path, uint64_t *hash);
+
+/* Looks the ROM up in the cache, analysing (and caching) it on a miss */
+void rom_info(const Chip8 *c, uint64_t hash, RomInfo *info);
+
+/* Prints a summary of the analysis, for emu_sdl -i */
+void rom_print(const RomInfo *info, uint64_t hash);
+
+/* True when the instruction at pc is a known idle loop that is still
+   there, so the rest of the frame can be skipped without changing state */
+static inline int rom_is_idle(const RomInfo *info, const Chip8 *c) {
+  uint16_t pc = c->pc;
+  return pc < MEM_SIZE - 1 && (info->map[pc] & ROM_IDLE) &&
+         ((c->mem[pc] << 8) | c->mem[pc + 1]) == (0x1000 | pc);
+}
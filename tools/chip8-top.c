@@ -0,0 +1,151 @@
+/* chip8-top: shows live metrics for every running emulator by reading the
+   /dev/shm/chip8-<pid> segments they publish. Usage: chip8-top [seconds] */
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+#define MAX_INSTANCES 1024
+
+/* An instance is its pid and start time, pids get reused */
+typedef struct {
+  int pid;
+  uint64_t start_ns;
+  MetricsData last;
+} Seen;
+
+/* Value (in ns) at quantile q of the difference between two histograms,
+   reported as the lower edge of the bucket it falls in */
+uint64_t quantile(const uint64_t *now, const uint64_t *before, double q) {
+  uint64_t total = 0;
+  for (int i = 0; i < METRICS_BUCKETS; i++) {
+    total += now[i] - before[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+
+  uint64_t want = (uint64_t)(q * (total - 1)) + 1;
+  uint64_t count = 0;
+  for (int i = 0; i < METRICS_BUCKETS; i++) {
+    count += now[i] - before[i];
+    if (count >= want) {
+      return i ? (uint64_t)1 << i : 0;
+    }
+  }
+  return 0;
+}
+
+/* Prints a duration in a unit that fits in a few columns */
+void print_ns(uint64_t ns) {
+  if (ns >= 1000000000) {
+    printf(" %7.2fs ", ns / 1e9);
+  } else if (ns >= 1000000) {
+    printf(" %7.2fms", ns / 1e6);
+  } else if (ns >= 1000) {
+    printf(" %7.2fus", ns / 1e3);
+  } else {
+    printf(" %7luns", (unsigned long)ns);
+  }
+}
+
+int main(int argc, char **args) {
+  unsigned interval = 1;
+  if (argc > 1) {
+    interval = atoi(args[1]);
+    if (interval == 0) {
+      interval = 1;
+    }
+  }
+
+  /* What the previous scan saw, and what this one sees. Only instances in
+     the current scan are kept, so exited ones drop out */
+  static Seen seen[MAX_INSTANCES], now_seen[MAX_INSTANCES];
+  int n_seen = 0;
+
+  while (1) {
+    DIR *dir = opendir("/dev/shm");
+    if (!dir) {
+      perror("chip8-top: /dev/shm");
+      return 1;
+    }
+
+    /* Clear screen and home cursor */
+    printf("\033[H\033[2J");
+    printf("%7s %7s %9s %9s %6s %6s %10s %10s %10s %10s\n", "PID", "TARGET",
+           "INS/S", "IDLE/S", "TICK/S", "SLEEP%", "JITTER50", "JITTER99",
+           "PRESENT99", "SLEEP99");
+
+    int n_now = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+      if (strncmp(entry->d_name, METRICS_PREFIX, strlen(METRICS_PREFIX))) {
+        continue;
+      }
+
+      const Metrics *m = metrics_attach(entry->d_name);
+      if (!m) {
+        continue;
+      }
+      /* A crashed emulator leaves its segment behind, skip those. EPERM
+         means it is alive but someone else's, still worth showing */
+      if (kill(m->pid, 0) < 0 && errno == ESRCH) {
+        metrics_detach(m);
+        continue;
+      }
+
+      MetricsData cur;
+      int pid = m->pid;
+      uint32_t cycles = m->cycles;
+      int ok = metrics_snapshot(m, &cur);
+      metrics_detach(m);
+      if (ok < 0) {
+        continue;
+      }
+
+      /* Rates and histograms are over the last refresh interval, or since
+         the emulator started the first time we see it */
+      MetricsData before = {.updated_ns = cur.start_ns};
+      for (int i = 0; i < n_seen; i++) {
+        if (seen[i].pid == pid && seen[i].start_ns == cur.start_ns) {
+          before = seen[i].last;
+          break;
+        }
+      }
+      if (n_now < MAX_INSTANCES) {
+        now_seen[n_now++] = (Seen){pid, cur.start_ns, cur};
+      }
+
+      double secs = (cur.updated_ns - before.updated_ns) / 1e9;
+      if (secs <= 0) {
+        secs = 1;
+      }
+
+      /* INS/S is what actually ran, IDLE/S what idle loops let us skip */
+      printf("%7d %7u %9.1f %9.1f %6.1f %6.1f", pid, cycles,
+             (cur.instructions - before.instructions) / secs,
+             (cur.idle_skipped - before.idle_skipped) / secs,
+             (cur.ticks - before.ticks) / secs,
+             (cur.sleep_ns - before.sleep_ns) / 1e9 / secs * 100);
+      print_ns(quantile(cur.tick_jitter, before.tick_jitter, 0.5));
+      print_ns(quantile(cur.tick_jitter, before.tick_jitter, 0.99));
+      print_ns(quantile(cur.present, before.present, 0.99));
+      print_ns(quantile(cur.sleep, before.sleep, 0.99));
+      printf("\n");
+    }
+    closedir(dir);
+
+    memcpy(seen, now_seen, n_now * sizeof *seen);
+    n_seen = n_now;
+
+    fflush(stdout);
+    sleep(interval);
+  }
+
+  return 0;
+}
@@ -0,0 +1,437 @@
+/* Differential fuzzer: runs random programs from random states on the
+   reference core (chip8_step) and on every candidate core in lockstep,
+   comparing the whole state after each instruction. The first divergence is
+   minimised and printed.
+
+   Usage: fuzz [-n cases per thread] [-s seed] [-j threads] [-k steps] */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "core.h"
+#include "display.h"
+
+typedef struct {
+  const char *name;
+  void (*step)(Chip8 *c);
+} Core;
+
+/* Cores checked against chip8_step. Add a faster core here to fuzz it; the
+   reference itself is listed so the harness also catches a core that
+   depends on anything outside its Chip8 (uninitialised memory, host state) */
+static const Core candidates[] = {
+    {"reference", chip8_step},
+};
+#define N_CANDIDATES (int)(sizeof candidates / sizeof candidates[0])
+
+/* 8XY0 with X = Y = 0, does nothing. Used to blank out instructions while
+   minimising */
+#define NOP 0x8000
+
+static long cases = 1000000;
+static int max_steps = 256;
+static uint64_t base_seed;
+
+static atomic_int found;
+static atomic_long cases_run;
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* splitmix64, one per thread */
+static uint64_t next(uint64_t *s) {
+  uint64_t z = (*s += 0x9E3779B97F4A7C15);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+  return z ^ (z >> 31);
+}
+
+/* Register numbers and immediates lean towards the values where the
+   flag logic has edge cases */
+static uint16_t gen_reg(uint64_t *s) {
+  uint64_t r = next(s);
+  return (r & 3) == 0 ? 0xF : (r >> 8) & 0xF;
+}
+
+static uint16_t gen_byte(uint64_t *s) {
+  static const uint8_t edges[] = {0x00, 0x01, 0x7F, 0x80, 0xFE, 0xFF};
+  uint64_t r = next(s);
+  return (r & 3) == 0 ? edges[(r >> 8) % sizeof edges] : (r >> 16) & 0xFF;
+}
+
+static uint16_t gen_addr(uint64_t *s) {
+  uint64_t r = next(s);
+  /* Mostly even addresses in the program area so execution keeps going,
+     sometimes anywhere (including odd, and near the end for wrapping) */
+  if (r & 7) {
+    return (START_ADDR + ((r >> 8) % (MEM_SIZE - START_ADDR))) & 0xFFE;
+  }
+  return (r >> 8) & 0xFFF;
+}
+
+/* One valid instruction, every opcode the reference implements */
+static uint16_t gen_instruction(uint64_t *s) {
+  uint16_t x = gen_reg(s) << 8;
+  uint16_t y = gen_reg(s) << 4;
+
+  switch (next(s) % 34) {
+  case 0:
+    return 0x00E0;
+  case 1:
+    return 0x00EE;
+  case 2:
+    return 0x1000 | gen_addr(s);
+  case 3:
+    return 0x2000 | gen_addr(s);
+  case 4:
+    return 0x3000 | x | gen_byte(s);
+  case 5:
+    return 0x4000 | x | gen_byte(s);
+  case 6:
+    return 0x5000 | x | y;
+  case 7:
+    return 0x6000 | x | gen_byte(s);
+  case 8:
+    return 0x7000 | x | gen_byte(s);
+  case 9:
+  case 10:
+  case 11:
+  case 12:
+  case 13:
+  case 14:
+  case 15:
+  case 16:
+    return 0x8000 | x | y | (next(s) % 8);
+  case 17:
+    return 0x800E | x | y;
+  case 18:
+    return 0x9000 | x | y;
+  case 19:
+    return 0xA000 | gen_addr(s);
+  case 20:
+    return 0xB000 | gen_addr(s);
+  case 21:
+    return 0xC000 | x | gen_byte(s);
+  case 22:
+    return 0xD000 | x | y | (next(s) & 0xF);
+  case 23:
+    return 0xE09E | x;
+  case 24:
+    return 0xE0A1 | x;
+  case 25:
+    return 0xF007 | x;
+  case 26:
+    return 0xF00A | x;
+  case 27:
+    return 0xF015 | x;
+  case 28:
+    return 0xF018 | x;
+  case 29:
+  case 30:
+    return 0xF01E | x;
+  case 31:
+    return 0xF029 | x;
+  case 32:
+    return 0xF033 | x;
+  default:
+    return (next(s) & 1 ? 0xF055 : 0xF065) | x;
+  }
+}
+
+static void gen_state(Chip8 *c, uint64_t *s) {
+  chip8_init(c, next(s));
+
+  /* Below START_ADDR is random bytes with the font in place, above it is
+     random instructions, which FX65 and DXYN also read as data. 1 in 8 is
+     any 16-bit word rather than a canonical encoding, so the loose decoding
+     (0NNN, 5XYn, EXnE, unknown 8XYn and FXnn...) gets run too */
+  for (int i = 0; i < START_ADDR; i++) {
+    c->mem[i] = next(s);
+  }
+  init_font(&c->mem[FONT_ADDR]);
+  for (int addr = START_ADDR; addr < MEM_SIZE; addr += 2) {
+    uint16_t ins = next(s) & 7 ? gen_instruction(s) : next(s);
+    c->mem[addr] = ins >> 8;
+    c->mem[addr + 1] = ins & 0xFF;
+  }
+
+  for (int i = 0; i < 16; i++) {
+    c->reg[i] = gen_byte(s);
+  }
+  c->stack.len = next(s) % 16;
+  for (int i = 0; i < c->stack.len; i++) {
+    c->stack.stack[i] = gen_addr(s);
+  }
+  c->ind = next(s) & 0xFFF;
+  c->delay_timer = gen_byte(s);
+  c->sound_timer = gen_byte(s);
+  c->keys = next(s);
+  for (int i = 0; i < WIDTH * HEIGHT; i++) {
+    c->display[i] = (next(s) & 7) == 0;
+  }
+}
+
+/* Name of the first field that differs, NULL if the states match */
+static const char *diff(const Chip8 *a, const Chip8 *b) {
+  if (a->pc != b->pc) {
+    return "pc";
+  }
+  if (memcmp(a->reg, b->reg, sizeof a->reg)) {
+    return "registers";
+  }
+  if (a->ind != b->ind) {
+    return "ind";
+  }
+  if (a->stack.len != b->stack.len ||
+      memcmp(a->stack.stack, b->stack.stack, sizeof a->stack.stack)) {
+    return "stack";
+  }
+  if (a->delay_timer != b->delay_timer || a->sound_timer != b->sound_timer) {
+    return "timers";
+  }
+  if (a->keys != b->keys) {
+    return "keys";
+  }
+  if (a->rng != b->rng) {
+    return "rng";
+  }
+  if (a->unknown != b->unknown || a->last_unknown != b->last_unknown) {
+    return "unknown instruction count";
+  }
+  if (memcmp(a->mem, b->mem, sizeof a->mem)) {
+    return "memory";
+  }
+  if (memcmp(a->display, b->display, sizeof a->display)) {
+    return "display";
+  }
+  return NULL;
+}
+
+/* Runs both cores from the same state. Returns the step (0-based) after
+   which they first differ, or -1. If executed isn't NULL, marks the
+   addresses the reference fetched from */
+static int run(const Chip8 *start, const Core *cand, int steps,
+               const char **field, uint8_t *executed) {
+  static _Thread_local Chip8 ref, other;
+  ref = *start;
+  other = *start;
+
+  for (int i = 0; i < steps; i++) {
+    if (executed) {
+      executed[ref.pc & 0xFFF] = 1;
+    }
+    chip8_step(&ref);
+    cand->step(&other);
+    const char *what = diff(&ref, &other);
+    if (what) {
+      if (field) {
+        *field = what;
+      }
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void set_word(Chip8 *c, int addr, uint16_t word) {
+  c->mem[addr] = word >> 8;
+  c->mem[(addr + 1) & 0xFFF] = word & 0xFF;
+}
+
+/* Shrinks a diverging case: fewer steps, as many executed instructions as
+   possible turned into NOPs, and as much of the initial state zeroed as
+   possible, as long as it still diverges */
+static int minimise(Chip8 *c, const Core *cand, int steps) {
+  static _Thread_local Chip8 trial;
+  static _Thread_local uint8_t executed[MEM_SIZE];
+
+  steps = run(c, cand, steps, NULL, NULL) + 1;
+
+  int changed = 1;
+  while (changed) {
+    changed = 0;
+
+    memset(executed, 0, sizeof executed);
+    run(c, cand, steps, NULL, executed);
+    for (int addr = 0; addr < MEM_SIZE; addr++) {
+      uint16_t word = (c->mem[addr] << 8) | c->mem[(addr + 1) & 0xFFF];
+      if (!executed[addr] || word == NOP) {
+        continue;
+      }
+      trial = *c;
+      set_word(&trial, addr, NOP);
+      int at = run(&trial, cand, steps, NULL, NULL);
+      if (at >= 0) {
+        *c = trial;
+        steps = at + 1;
+        changed = 1;
+      }
+    }
+
+    for (int i = 0; i < 16; i++) {
+      if (c->reg[i] == 0) {
+        continue;
+      }
+      trial = *c;
+      trial.reg[i] = 0;
+      int at = run(&trial, cand, steps, NULL, NULL);
+      if (at >= 0) {
+        *c = trial;
+        steps = at + 1;
+        changed = 1;
+      }
+    }
+
+    /* The rest in one go each */
+    for (int what = 0; what < 5; what++) {
+      trial = *c;
+      switch (what) {
+      case 0:
+        memset(trial.display, 0, sizeof trial.display);
+        break;
+      case 1:
+        trial.keys = 0;
+        break;
+      case 2:
+        trial.delay_timer = 0;
+        trial.sound_timer = 0;
+        break;
+      case 3:
+        trial.stack.len = 0;
+        memset(trial.stack.stack, 0, sizeof trial.stack.stack);
+        break;
+      case 4:
+        trial.ind = 0;
+        break;
+      }
+      if (!memcmp(&trial, c, sizeof trial)) {
+        continue;
+      }
+      int at = run(&trial, cand, steps, NULL, NULL);
+      if (at >= 0) {
+        *c = trial;
+        steps = at + 1;
+        changed = 1;
+      }
+    }
+  }
+
+  return steps;
+}
+
+static void report(const Chip8 *c, const Core *cand, int steps,
+                   uint64_t seed) {
+  static uint8_t executed[MEM_SIZE];
+  const char *field = NULL;
+  memset(executed, 0, sizeof executed);
+  run(c, cand, steps, &field, executed);
+
+  fprintf(stderr,
+          "\n%s diverges from the reference in %s after %d instruction(s)"
+          " (case seed 0x%016llx)\n",
+          cand->name, field, steps, (unsigned long long)seed);
+
+  fprintf(stderr, "initial state:\n  pc=%03X ind=%03X dt=%02X st=%02X "
+                  "keys=%04X rng=%08X\n  V:",
+          c->pc, c->ind, c->delay_timer, c->sound_timer, c->keys, c->rng);
+  for (int i = 0; i < 16; i++) {
+    fprintf(stderr, " %02X", c->reg[i]);
+  }
+  fprintf(stderr, "\n  stack(%d):", c->stack.len);
+  for (int i = 0; i < c->stack.len; i++) {
+    fprintf(stderr, " %03X", c->stack.stack[i]);
+  }
+  int lit = 0;
+  for (int i = 0; i < WIDTH * HEIGHT; i++) {
+    lit += c->display[i];
+  }
+  fprintf(stderr, "\n  display: %d pixel(s) on\nprogram (executed, NOPs "
+                  "left out):\n",
+          lit);
+  for (int addr = 0; addr < MEM_SIZE; addr++) {
+    uint16_t word = (c->mem[addr] << 8) | c->mem[(addr + 1) & 0xFFF];
+    if (executed[addr] && word != NOP) {
+      fprintf(stderr, "  %03X: %04X\n", addr, word);
+    }
+  }
+}
+
+static void *worker(void *arg) {
+  long id = (long)arg;
+  static _Thread_local Chip8 start;
+
+  for (long n = 0; n < cases && !atomic_load(&found); n++) {
+    /* Each case gets its own seed so a report can be reproduced alone */
+    uint64_t case_seed = base_seed ^ ((uint64_t)id << 40) ^ n;
+    uint64_t s = case_seed;
+    gen_state(&start, &s);
+
+    for (int i = 0; i < N_CANDIDATES; i++) {
+      const char *field;
+      int at = run(&start, &candidates[i], max_steps, &field, NULL);
+      if (at < 0) {
+        continue;
+      }
+      /* Only the first thread to find something reports */
+      if (atomic_exchange(&found, 1)) {
+        return NULL;
+      }
+      int steps = minimise(&start, &candidates[i], at + 1);
+      pthread_mutex_lock(&report_lock);
+      report(&start, &candidates[i], steps, case_seed);
+      pthread_mutex_unlock(&report_lock);
+      return NULL;
+    }
+    atomic_fetch_add_explicit(&cases_run, 1, memory_order_relaxed);
+  }
+  return NULL;
+}
+
+int main(int argc, char **args) {
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  base_seed = time(NULL);
+
+  int opt;
+  while ((opt = getopt(argc, args, "n:s:j:k:")) != -1) {
+    switch (opt) {
+    case 'n':
+      cases = atol(optarg);
+      break;
+    case 's':
+      base_seed = strtoull(optarg, NULL, 0);
+      break;
+    case 'j':
+      threads = atol(optarg);
+      break;
+    case 'k':
+      max_steps = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n cases] [-s seed] [-j threads] "
+                      "[-k steps]\n",
+              args[0]);
+      return 2;
+    }
+  }
+  if (threads < 1) {
+    threads = 1;
+  }
+
+  fprintf(stderr, "fuzzing %d core(s), %ld thread(s), seed 0x%llx\n",
+          N_CANDIDATES, threads, (unsigned long long)base_seed);
+
+  pthread_t *ids = calloc(threads, sizeof *ids);
+  for (long i = 0; i < threads; i++) {
+    pthread_create(&ids[i], NULL, worker, (void *)i);
+  }
+  for (long i = 0; i < threads; i++) {
+    pthread_join(ids[i], NULL);
+  }
+  free(ids);
+
+  fprintf(stderr, "%ld case(s) without divergence\n",
+          atomic_load(&cases_run));
+  return atomic_load(&found) ? 1 : 0;
+}